@@ -0,0 +1,70 @@
+#ifndef _LAUNCH_FUTURE_H
+#define _LAUNCH_FUTURE_H
+
+#include "itasksys.h"
+#include <vector>
+
+/*
+ * LaunchFuture: a bulk launch that later launches can be chained onto
+ * after it has been submitted, so a graph can be built as it is
+ * discovered instead of declaring every edge up front.
+ *
+ *     LaunchFuture parsed = launchFuture(system, &parse, n);
+ *     LaunchFuture indexed = parsed.then(&index, n);
+ *     LaunchFuture counted = parsed.then(&count, 1);
+ *     whenAll({indexed, counted}).then(&report, 1).wait();
+ *
+ * then() submits its launch immediately with a dependency on the future's
+ * launch, which may still be running.  When that launch finishes, the
+ * thread finishing it releases the continuation.
+ *
+ * whenAll() and whenAny() submit an empty launch that finishes together
+ * with the last, or the first, of their inputs, so a combined future is
+ * itself a launch and can be waited for, chained or combined again.  All
+ * futures combined must belong to the same task system, and at least one
+ * must be given.
+ */
+class LaunchFuture {
+    public:
+        ITaskSystem* system;
+        TaskID task_id;
+
+        LaunchFuture(ITaskSystem* system, TaskID task_id) : system(system), task_id(task_id) {}
+
+        LaunchFuture then(IRunnable* runnable, int num_total_tasks) const {
+            return LaunchFuture(system, system -> runAsyncWithDeps(runnable, num_total_tasks,
+                                                                   std::vector<TaskID>{task_id}));
+        }
+
+        void wait() const {
+            system -> wait(task_id);
+        }
+
+        bool isDone() const {
+            return system -> isDone(task_id);
+        }
+};
+
+inline LaunchFuture launchFuture(ITaskSystem* system, IRunnable* runnable, int num_total_tasks) {
+    return LaunchFuture(system, system -> runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>()));
+}
+
+inline std::vector<TaskID> launchIds(const std::vector<LaunchFuture>& futures) {
+    std::vector<TaskID> ids;
+    for (const LaunchFuture& future : futures) {
+        ids.push_back(future.task_id);
+    }
+    return ids;
+}
+
+inline LaunchFuture whenAll(const std::vector<LaunchFuture>& futures) {
+    ITaskSystem* system = futures[0].system;
+    return LaunchFuture(system, system -> runAsyncWithDeps(nullptr, 0, launchIds(futures)));
+}
+
+inline LaunchFuture whenAny(const std::vector<LaunchFuture>& futures) {
+    ITaskSystem* system = futures[0].system;
+    return LaunchFuture(system, system -> runAsyncAfterAny(nullptr, 0, launchIds(futures)));
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _PARKING_WORD_H
+#define _PARKING_WORD_H
+
+#include <atomic>
+#include <climits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+/*
+ * Hint to the CPU that the caller is busy-waiting.
+ */
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+/*
+ * ParkingWord: a counter that threads can sleep on until it changes.
+ * On Linux parking is a futex wait on the counter itself; elsewhere it
+ * falls back to a mutex and condition variable.  bump() only enters the
+ * kernel when some thread is actually parked.
+ */
+class ParkingWord {
+    private:
+        std::atomic<int> value_;
+        std::atomic<int> parked_;
+#if !defined(__linux__)
+        std::mutex mutex_;
+        std::condition_variable cv_;
+#endif
+
+    public:
+        ParkingWord() : value_(0), parked_(0) {}
+
+        int load() {
+            return value_.load(std::memory_order_acquire);
+        }
+
+        // Changes the value and wakes every thread parked on it.
+        void bump() {
+            value_.fetch_add(1, std::memory_order_seq_cst);
+            if (parked_.load(std::memory_order_seq_cst) == 0) {
+                return;
+            }
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int*>(&value_), FUTEX_WAKE_PRIVATE,
+                    INT_MAX, nullptr, nullptr, 0);
+#else
+            mutex_.lock();
+            mutex_.unlock();
+            cv_.notify_all();
+#endif
+        }
+
+        // Sleeps while the value still equals `expected`.  May return
+        // spuriously, so callers re-check their own condition.
+        void park(int expected) {
+            parked_.fetch_add(1, std::memory_order_seq_cst);
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int*>(&value_), FUTEX_WAIT_PRIVATE,
+                    expected, nullptr, nullptr, 0);
+#else
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (value_.load(std::memory_order_acquire) == expected) {
+                cv_.wait(lock);
+            }
+#endif
+            parked_.fetch_sub(1, std::memory_order_seq_cst);
+        }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _SMALL_VECTOR_H
+#define _SMALL_VECTOR_H
+
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * SmallVector: growable array that keeps its first N elements inline and
+ * only allocates once it grows past them.  Elements are copied with
+ * memcpy, so T must be trivially copyable (pointers, integers).
+ */
+template <typename T, int N>
+class SmallVector {
+    private:
+        T* data_;
+        int size_;
+        int capacity_;
+        T inline_[N];
+
+    public:
+        SmallVector() : data_(inline_), size_(0), capacity_(N) {}
+
+        ~SmallVector() {
+            if (data_ != inline_) {
+                free(data_);
+            }
+        }
+
+        void push_back(const T& item) {
+            if (size_ == capacity_) {
+                T* bigger = static_cast<T*>(malloc(sizeof(T) * capacity_ * 2));
+                memcpy(bigger, data_, sizeof(T) * size_);
+                if (data_ != inline_) {
+                    free(data_);
+                }
+                data_ = bigger;
+                capacity_ *= 2;
+            }
+            data_[size_++] = item;
+        }
+
+        // Keeps any heap storage for reuse.
+        void clear() {
+            size_ = 0;
+        }
+
+        // Removes the first element equal to item, if any, by moving the
+        // last element into its place.  Does not keep the order.
+        void remove(const T& item) {
+            for (int i = 0; i < size_; i++) {
+                if (data_[i] == item) {
+                    data_[i] = data_[--size_];
+                    return;
+                }
+            }
+        }
+
+        int size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        T& operator[](int i) { return data_[i]; }
+        T* begin() { return data_; }
+        T* end() { return data_ + size_; }
+
+    private:
+        SmallVector(const SmallVector&);
+        SmallVector& operator=(const SmallVector&);
+};
+
+#endif
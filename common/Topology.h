@@ -0,0 +1,308 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * PinPolicy: where the threads of a pool are placed.
+ *
+ *  - PIN_NONE: leave placement to the kernel.
+ *  - PIN_COMPACT: one CPU per thread, filling the hyperthreads of a core,
+ *    then the cores of a node, before moving to the next node.
+ *  - PIN_SCATTER: one CPU per thread, spread round-robin over the nodes
+ *    and over distinct cores before doubling up on hyperthreads.
+ *  - PIN_NUMA_NODE: threads split into one contiguous block per node,
+ *    each allowed on any CPU of its node.
+ */
+enum PinPolicy {
+    PIN_NONE,
+    PIN_COMPACT,
+    PIN_SCATTER,
+    PIN_NUMA_NODE,
+};
+
+class CpuInfo {
+    public:
+        int cpu;
+        int core;
+        int package;
+        int node;
+        // Position among the hyperthreads of its core.
+        int smt_rank;
+};
+
+/*
+ * WorkerPlacement: the node a thread belongs to and the CPUs it may run
+ * on.  An empty cpu list means the thread is not pinned.
+ */
+class WorkerPlacement {
+    public:
+        int node;
+        std::vector<int> cpus;
+        WorkerPlacement() : node(0) {}
+};
+
+/*
+ * Topology: the CPUs this process may run on, as read from
+ * /sys/devices/system/cpu and /sys/devices/system/node.  Node numbers are
+ * renumbered densely from zero.  Anywhere the files are missing the
+ * machine is treated as a single node with one core per CPU.
+ */
+class Topology {
+    public:
+        std::vector<CpuInfo> cpus;
+        int num_nodes;
+
+        // Detected once per process.
+        static const Topology& system() {
+            static Topology topology = detect();
+            return topology;
+        }
+
+        static Topology detect() {
+            Topology topology;
+            topology.num_nodes = 1;
+#if defined(__linux__)
+            std::vector<int> online = readCpuList("/sys/devices/system/cpu/online");
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+            for (int cpu : online) {
+                if (have_mask && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))) {
+                    continue;
+                }
+                CpuInfo info;
+                std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                info.cpu = cpu;
+                info.core = readInt(dir + "core_id", cpu);
+                info.package = readInt(dir + "physical_package_id", 0);
+                info.node = 0;
+                info.smt_rank = 0;
+                topology.cpus.push_back(info);
+            }
+            readNodes(&topology);
+#endif
+            if (topology.cpus.empty()) {
+                int n = std::max(1, int(std::thread::hardware_concurrency()));
+                for (int cpu = 0; cpu < n; cpu++) {
+                    CpuInfo info = {cpu, cpu, 0, 0, 0};
+                    topology.cpus.push_back(info);
+                }
+            }
+
+            for (CpuInfo& info : topology.cpus) {
+                for (const CpuInfo& other : topology.cpus) {
+                    if (other.package == info.package && other.core == info.core && other.cpu < info.cpu) {
+                        info.smt_rank ++;
+                    }
+                }
+            }
+            return topology;
+        }
+
+        int nodeOf(int cpu) const {
+            for (const CpuInfo& info : cpus) {
+                if (info.cpu == cpu) {
+                    return info.node;
+                }
+            }
+            return 0;
+        }
+
+        // Placement of num_workers threads under policy.  Threads beyond the
+        // number of CPUs wrap around.
+        std::vector<WorkerPlacement> place(PinPolicy policy, int num_workers) const {
+            std::vector<WorkerPlacement> placement(num_workers);
+            if (policy == PIN_NONE || num_workers == 0) {
+                return placement;
+            }
+
+            if (policy == PIN_NUMA_NODE) {
+                for (int i = 0; i < num_workers; i++) {
+                    placement[i].node = int(int64_t(i) * num_nodes / num_workers);
+                    for (const CpuInfo& info : cpus) {
+                        if (info.node == placement[i].node) {
+                            placement[i].cpus.push_back(info.cpu);
+                        }
+                    }
+                }
+                return placement;
+            }
+
+            std::vector<CpuInfo> order = cpus;
+            if (policy == PIN_COMPACT) {
+                std::sort(order.begin(), order.end(), [](const CpuInfo& a, const CpuInfo& b) {
+                    if (a.node != b.node) return a.node < b.node;
+                    if (a.package != b.package) return a.package < b.package;
+                    if (a.core != b.core) return a.core < b.core;
+                    return a.smt_rank < b.smt_rank;
+                });
+            } else {
+                // Distinct cores first within each node, then interleave
+                // the nodes.
+                std::vector<std::vector<CpuInfo> > per_node(num_nodes);
+                for (const CpuInfo& info : cpus) {
+                    per_node[info.node].push_back(info);
+                }
+                for (std::vector<CpuInfo>& node_cpus : per_node) {
+                    std::sort(node_cpus.begin(), node_cpus.end(), [](const CpuInfo& a, const CpuInfo& b) {
+                        if (a.smt_rank != b.smt_rank) return a.smt_rank < b.smt_rank;
+                        if (a.package != b.package) return a.package < b.package;
+                        return a.core < b.core;
+                    });
+                }
+                order.clear();
+                for (size_t k = 0; order.size() < cpus.size(); k++) {
+                    for (std::vector<CpuInfo>& node_cpus : per_node) {
+                        if (k < node_cpus.size()) {
+                            order.push_back(node_cpus[k]);
+                        }
+                    }
+                }
+            }
+
+            for (int i = 0; i < num_workers; i++) {
+                const CpuInfo& info = order[i % order.size()];
+                placement[i].node = info.node;
+                placement[i].cpus.push_back(info.cpu);
+            }
+            return placement;
+        }
+
+    private:
+#if defined(__linux__)
+        // Parses a list such as "0-3,8,10-11".
+        static std::vector<int> parseCpuList(const std::string& text) {
+            std::vector<int> list;
+            size_t pos = 0;
+            while (pos < text.size()) {
+                int first, last, used = 0;
+                if (sscanf(text.c_str() + pos, "%d-%d%n", &first, &last, &used) == 2 && used > 0) {
+                    pos += used;
+                } else if (sscanf(text.c_str() + pos, "%d%n", &first, &used) == 1 && used > 0) {
+                    last = first;
+                    pos += used;
+                } else {
+                    break;
+                }
+                for (int cpu = first; cpu <= last; cpu++) {
+                    list.push_back(cpu);
+                }
+                if (pos < text.size() && text[pos] == ',') {
+                    pos++;
+                } else {
+                    break;
+                }
+            }
+            return list;
+        }
+
+        static std::string readLine(const std::string& path) {
+            std::string line;
+            FILE* file = fopen(path.c_str(), "r");
+            if (file == nullptr) {
+                return line;
+            }
+            char buffer[4096];
+            if (fgets(buffer, sizeof(buffer), file) != nullptr) {
+                line = buffer;
+            }
+            fclose(file);
+            return line;
+        }
+
+        static std::vector<int> readCpuList(const std::string& path) {
+            return parseCpuList(readLine(path));
+        }
+
+        static int readInt(const std::string& path, int fallback) {
+            int value;
+            std::string line = readLine(path);
+            return sscanf(line.c_str(), "%d", &value) == 1 ? value : fallback;
+        }
+
+        static void readNodes(Topology* topology) {
+            DIR* dir = opendir("/sys/devices/system/node");
+            if (dir == nullptr) {
+                return;
+            }
+            std::vector<int> node_ids;
+            while (struct dirent* entry = readdir(dir)) {
+                int id;
+                char tail;
+                if (sscanf(entry -> d_name, "node%d%c", &id, &tail) == 1) {
+                    node_ids.push_back(id);
+                }
+            }
+            closedir(dir);
+            std::sort(node_ids.begin(), node_ids.end());
+
+            // Nodes without any CPU this process may use (memory-only
+            // nodes, or nodes outside its affinity mask) are dropped.
+            int dense = 0;
+            for (int id : node_ids) {
+                std::vector<int> node_cpus =
+                    readCpuList("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+                bool used = false;
+                for (CpuInfo& info : topology -> cpus) {
+                    if (std::find(node_cpus.begin(), node_cpus.end(), info.cpu) != node_cpus.end()) {
+                        info.node = dense;
+                        used = true;
+                    }
+                }
+                if (used) {
+                    dense++;
+                }
+            }
+            topology -> num_nodes = std::max(dense, 1);
+        }
+#endif
+};
+
+/*
+ * Restricts the calling thread to cpus.  Does nothing for an empty list.
+ * Returns false if the thread could not be pinned.
+ */
+inline bool pinCurrentThread(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return true;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Node of the CPU the calling thread is running on right now.
+ */
+inline int currentNode() {
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return Topology::system().nodeOf(cpu);
+    }
+#endif
+    return 0;
+}
+
+#endif
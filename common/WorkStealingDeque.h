@@ -0,0 +1,132 @@
+#ifndef _WORK_STEALING_DEQUE_H
+#define _WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * WorkStealingDeque: Chase-Lev deque of pointers.  The owning thread
+ * pushes and pops at the bottom, any other thread may steal from the top.
+ * Memory orderings follow Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ *
+ * The buffer grows on demand.  Buffers that have been replaced are kept
+ * until the deque is destroyed since a thief may still be reading them.
+ */
+template <typename T>
+class WorkStealingDeque {
+    private:
+        class Buffer {
+            public:
+                int64_t capacity;
+                std::atomic<T*>* slots;
+
+                Buffer(int64_t capacity) {
+                    this -> capacity = capacity;
+                    this -> slots = new std::atomic<T*>[capacity];
+                }
+                ~Buffer() {
+                    delete[] slots;
+                }
+
+                T* get(int64_t i) {
+                    return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+                }
+                void put(int64_t i, T* item) {
+                    slots[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+                }
+                Buffer* grow(int64_t bottom, int64_t top) {
+                    Buffer* bigger = new Buffer(capacity * 2);
+                    for (int64_t i = top; i < bottom; i++) {
+                        bigger -> put(i, get(i));
+                    }
+                    return bigger;
+                }
+        };
+
+        std::atomic<int64_t> top_;
+        std::atomic<int64_t> bottom_;
+        std::atomic<Buffer*> buffer_;
+        std::vector<Buffer*> retired_;
+
+    public:
+        WorkStealingDeque(int64_t capacity = 256) {
+            top_.store(0, std::memory_order_relaxed);
+            bottom_.store(0, std::memory_order_relaxed);
+            buffer_.store(new Buffer(capacity), std::memory_order_relaxed);
+        }
+
+        ~WorkStealingDeque() {
+            for (Buffer* b : retired_) {
+                delete b;
+            }
+            delete buffer_.load(std::memory_order_relaxed);
+        }
+
+        // Owner only.
+        void push(T* item) {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_acquire);
+            Buffer* a = buffer_.load(std::memory_order_relaxed);
+            if (b - t > a -> capacity - 1) {
+                retired_.push_back(a);
+                a = a -> grow(b, t);
+                buffer_.store(a, std::memory_order_release);
+            }
+            a -> put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // Owner only.  Returns nullptr when the deque is empty.
+        T* pop() {
+            int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+            Buffer* a = buffer_.load(std::memory_order_relaxed);
+            bottom_.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top_.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                bottom_.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T* item = a -> get(b);
+            if (t == b) {
+                // Last element: race against thieves for it.
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // Any thread.  Returns nullptr when the deque is empty or the steal
+        // lost a race with the owner or another thief.
+        T* steal() {
+            int64_t t = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom_.load(std::memory_order_acquire);
+            if (t >= b) {
+                return nullptr;
+            }
+            Buffer* a = buffer_.load(std::memory_order_acquire);
+            T* item = a -> get(t);
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return item;
+        }
+
+        // Approximate when called concurrently with push/pop/steal.
+        bool empty() {
+            int64_t b = bottom_.load(std::memory_order_relaxed);
+            int64_t t = top_.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+};
+
+#endif
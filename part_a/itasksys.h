@@ -1,8 +1,10 @@
 #ifndef _ITASKSYS_H
 #define _ITASKSYS_H
+#include <chrono>
+#include <cstdint>
 #include <vector>
 
-typedef int TaskID;
+typedef int64_t TaskID;
 
 class IRunnable {
     public:
@@ -16,8 +18,27 @@ class IRunnable {
               
            - num_total_tasks: the total number of tasks in the bulk
              task launch.
+
+          If runTask() throws, the task system keeps the first
+          exception of the launch, drops the launch's tasks that have
+          not started yet and cancels the launches depending on it, as
+          cancel() does.  run() rethrows it, as do the next sync() and
+          wait() on the launch or one of its dependents.  Task systems
+          that run launches on the calling thread let it propagate from
+          the call that runs them.
          */
         virtual void runTask(int task_id, int num_total_tasks) = 0;
+
+        /*
+          Whether the tasks of a cancelled launch of this runnable still
+          run instead of being dropped.  They see isCancelled() return
+          true, and do not take on the exception of a failed
+          predecessor.  Meant for continuations that must run to clean
+          up, such as those resuming coroutines.
+
+          The default returns false.
+         */
+        virtual bool runsWhenCancelled();
 };
 
 class ITaskSystem {
@@ -66,5 +87,95 @@ class ITaskSystem {
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Blocks until the bulk task launch `task_id`, or every launch
+          in `task_ids`, is done.  Unlike sync(), later launches and
+          launches that were not asked for may still be running when
+          wait() returns.
+
+          The default waits for everything by calling sync().
+         */
+        virtual void wait(TaskID task_id);
+        virtual void wait(const std::vector<TaskID>& task_ids);
+
+        /*
+          Returns whether the bulk task launch `task_id` is done,
+          without blocking.
+
+          The default suits task systems that complete each launch
+          before runAsyncWithDeps() returns and always returns true.
+         */
+        virtual bool isDone(TaskID task_id);
+
+        /*
+          Like runAsyncWithDeps(), but the launch may start as soon as
+          any one of the launches in `deps` is done, rather than all of
+          them.  With empty deps it may start right away.
+
+          The default waits for all of `deps`, which suits task systems
+          that complete each launch before runAsyncWithDeps() returns.
+         */
+        virtual TaskID runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                        const std::vector<TaskID>& deps);
+
+        /*
+          Cancels the bulk task launch `task_id`.  Task indices that
+          have not been started yet are dropped, running tasks can stop
+          early by checking isCancelled(), and launches depending on
+          `task_id` are cancelled in turn.  A cancelled launch still
+          counts as done once its running tasks return, for wait(),
+          sync() and as a dependency.
+
+          The default does nothing, which suits task systems that
+          complete each launch before runAsyncWithDeps() returns.
+         */
+        virtual void cancel(TaskID task_id);
+
+        /*
+          Called through BlockingRegion by a task of this system that is
+          about to block, and again once it stops blocking.  A task
+          system may run a spare thread in the meantime so that blocked
+          tasks do not keep cores idle.
+
+          The defaults do nothing.
+         */
+        virtual void beginBlocking();
+        virtual void endBlocking();
+};
+
+/*
+  Declares that the task the calling thread is running blocks (sleeps,
+  waits on a lock, on I/O, ...) for the lifetime of the object, so the
+  task system running it may compensate:
+
+      {
+          BlockingRegion blocking;
+          std::this_thread::sleep_for(...);
+      }
+
+  Does nothing when the calling thread is not running a task.
+ */
+class BlockingRegion {
+    public:
+        BlockingRegion();
+        ~BlockingRegion();
+    private:
+        ITaskSystem* system_;
+        BlockingRegion(const BlockingRegion&);
+        BlockingRegion& operator=(const BlockingRegion&);
 };
+
+/*
+  Sleeps for `duration` from inside a task.  Task systems that run tasks
+  on fibers park the calling fiber and run others meanwhile; elsewhere
+  this is a sleep inside a BlockingRegion.
+ */
+void taskSleepFor(std::chrono::microseconds duration);
+
+/*
+  Returns whether the launch of the task the calling thread is running
+  has been cancelled.  Always false outside a task.
+ */
+bool isCancelled();
 #endif
@@ -1,11 +1,52 @@
 #include "tasksys.h"
+#include <algorithm>
 #include <mutex>
 
 IRunnable::~IRunnable() {}
 
+bool IRunnable::runsWhenCancelled() {
+    return false;
+}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+void ITaskSystem::wait(const std::vector<TaskID>& task_ids) {
+    sync();
+}
+
+bool ITaskSystem::isDone(TaskID task_id) {
+    return true;
+}
+
+TaskID ITaskSystem::runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                     const std::vector<TaskID>& deps) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::cancel(TaskID task_id) {}
+
+void ITaskSystem::beginBlocking() {}
+void ITaskSystem::endBlocking() {}
+
+// The Part A pools run one launch at a time with a fixed set of threads,
+// so they do not compensate for blocked tasks.
+BlockingRegion::BlockingRegion() : system_(nullptr) {}
+BlockingRegion::~BlockingRegion() {}
+
+void taskSleepFor(std::chrono::microseconds duration) {
+    std::this_thread::sleep_for(duration);
+}
+
+// The Part A task systems do not implement cancel().
+bool isCancelled() {
+    return false;
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -56,14 +97,12 @@ TaskSystemParallelSpawn::TaskSystemParallelSpawn(int num_threads): ITaskSystem(n
     // (requiring changes to tasksys.h).
     //
     this -> num_threads_ = num_threads;
-    threads_pool_ = new std::thread[num_threads];
 }
 
-TaskSystemParallelSpawn::~TaskSystemParallelSpawn() {
-    delete[] threads_pool_;
-}
+TaskSystemParallelSpawn::~TaskSystemParallelSpawn() {}
 
-void TaskSystemParallelSpawn::threadRun(IRunnable* runnable, int num_total_tasks, std::mutex* mtx, int* curr_task){
+void TaskSystemParallelSpawn::threadRun(IRunnable* runnable, int num_total_tasks, std::mutex* mtx, int* curr_task,
+                                        std::exception_ptr* error){
     int rem_task = -1;
     while(rem_task < num_total_tasks){
         mtx -> lock();
@@ -73,7 +112,18 @@ void TaskSystemParallelSpawn::threadRun(IRunnable* runnable, int num_total_tasks
         if(rem_task >= num_total_tasks){
             break;
         }
-        runnable->runTask(rem_task, num_total_tasks);
+        try {
+            runnable->runTask(rem_task, num_total_tasks);
+        } catch (...) {
+            // Keep the first exception for run() and stop handing out
+            // tasks.
+            mtx -> lock();
+            if (!*error) {
+                *error = std::current_exception();
+            }
+            *curr_task = num_total_tasks;
+            mtx -> unlock();
+        }
     }
 }
 
@@ -87,17 +137,24 @@ void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
     // for (int i = 0; i < num_total_tasks; i++) {
     //     runnable->runTask(i, num_total_tasks);
     // }
+    // Threads belong to this call so that a task may call run() again.
+    std::vector<std::thread> threads(num_threads_);
     std::mutex* mtx = new std::mutex();
     int* curr_task = new int;
     *curr_task = 0;
+    std::exception_ptr error;
     for (int i = 0; i < num_threads_; i++){
-        threads_pool_[i] = std::thread(&TaskSystemParallelSpawn::threadRun, this, runnable, num_total_tasks, mtx, curr_task);
+        threads[i] = std::thread(&TaskSystemParallelSpawn::threadRun, this, runnable, num_total_tasks, mtx, curr_task,
+                                 &error);
     }
     for (int i = 0; i < num_threads_; i++){
-        threads_pool_[i].join();
+        threads[i].join();
     }
     delete mtx;
     delete curr_task;
+    if (error) {
+        std::rethrow_exception(error);
+    }
 }
 
 TaskID TaskSystemParallelSpawn::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
@@ -117,39 +174,462 @@ void TaskSystemParallelSpawn::sync() {
  * ================================================================
  */
 
-TaskState::TaskState(){
-    mutex_ = new std::mutex();
+static const int EPOCH_SHIFT = 40;
+static const int EPOCH_MASK = (1 << 24) - 1;
+static const uint64_t INDEX_MASK = (uint64_t(1) << EPOCH_SHIFT) - 1;
+
+// Chunk size used when a launch does not ask for one: a few chunks per
+// thread keeps claims cheap without giving up load balance.
+static int defaultGrainSize(int num_total_tasks, int num_workers) {
+    return std::max(1, num_total_tasks / (4 * std::max(num_workers, 1)));
+}
+
+// PARTITION_AFFINITY steals only from threads with more chunks left than
+// this when the partitioner does not say otherwise.
+static const int DEFAULT_STEAL_THRESHOLD = 1;
+
+TaskState::TaskState(int num_slots){
     finished_ = new std::condition_variable();
     finished_mutex_ = new std::mutex();
+    next_task_ = 0;
+    params_epoch_ = 0;
+    kind_ = PARTITION_DYNAMIC;
     runnable_ = nullptr;
-    finished_tasks_ = -1;
-    left_tasks_ = -1;
-    num_total_tasks_ = -1;
+    num_total_tasks_ = 0;
+    grain_size_ = 1;
+    steal_threshold_ = DEFAULT_STEAL_THRESHOLD;
+    finished_tasks_ = 0;
+    failed_ = false;
+    epoch_ = 0;
+    num_slots_ = num_slots;
+    ranges_ = new WorkerRange*[num_slots];
+    queues_ = new AffinityQueue*[num_slots];
+    for (int i = 0; i < num_slots; i++) {
+        ranges_[i] = new WorkerRange();
+        queues_[i] = new AffinityQueue();
+    }
+    affinity_tasks_ = -1;
+    affinity_grain_ = 0;
+    slot_node_.assign(num_slots, 0);
+    spans_nodes_ = false;
+}
+
+// Slots beyond the placement (the caller's) get node -1.
+void TaskState::setSlotNodes(const std::vector<WorkerPlacement>& placement){
+    spans_nodes_ = false;
+    for (int i = 0; i < num_slots_; i++) {
+        slot_node_[i] = i < int(placement.size()) && !placement[i].cpus.empty() ? placement[i].node : -1;
+        if (slot_node_[i] >= 0 && slot_node_[i] != slot_node_[0]) {
+            spans_nodes_ = true;
+        }
+    }
 }
 
 TaskState::~TaskState(){
-    delete mutex_;
+    for (int i = 0; i < num_slots_; i++) {
+        delete ranges_[i];
+        delete queues_[i];
+    }
+    delete[] ranges_;
+    delete[] queues_;
     delete finished_;
     delete finished_mutex_;
 }
 
+// Makes a new launch visible to the pool.  Only called once the previous
+// launch has finished, so no claim can still be running tasks of it.
+void TaskState::publish(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner){
+    int grain_size = partitioner.grain_size;
+    if (partitioner.kind == PARTITION_STATIC) {
+        grain_size = (num_total_tasks + num_slots_ - 1) / num_slots_;
+    } else if (grain_size <= 0) {
+        grain_size = defaultGrainSize(num_total_tasks, num_slots_);
+    }
+
+    epoch_ = (epoch_ + 1) & EPOCH_MASK;
+    params_epoch_ = -1;
+    kind_ = partitioner.kind;
+    runnable_ = runnable;
+    num_total_tasks_ = num_total_tasks;
+    grain_size_ = std::max(grain_size, 1);
+    steal_threshold_ = partitioner.steal_threshold > 0 ? partitioner.steal_threshold : DEFAULT_STEAL_THRESHOLD;
+    finished_tasks_ = 0;
+    failed_ = false;
+
+    uint64_t first_task = 0;
+    if (partitioner.kind == PARTITION_AUTO) {
+        for (int i = 0; i < num_slots_; i++) {
+            WorkerRange* range = ranges_[i];
+            std::lock_guard<std::mutex> lock(range -> mutex_);
+            range -> epoch_ = epoch_;
+            range -> begin_ = int(int64_t(num_total_tasks) * i / num_slots_);
+            range -> end_ = int(int64_t(num_total_tasks) * (i + 1) / num_slots_);
+        }
+        // The shared counter starts exhausted so stray claims find nothing.
+        first_task = uint64_t(std::max(num_total_tasks, 0));
+    } else if (partitioner.kind == PARTITION_AFFINITY) {
+        assignAffinityChunks(num_total_tasks, grain_size_);
+        first_task = uint64_t(std::max(num_total_tasks, 0));
+    }
+
+    params_epoch_ = epoch_;
+    next_task_ = (uint64_t(epoch_) << EPOCH_SHIFT) | first_task;
+}
+
+// Reads the launch parameters, failing if they are being rewritten.
+bool TaskState::readParams(LaunchParams* params){
+    int epoch = params_epoch_;
+    params -> kind = PartitionerKind(kind_.load());
+    params -> runnable = runnable_;
+    params -> num_total_tasks = num_total_tasks_;
+    params -> grain_size = grain_size_;
+    params -> steal_threshold = steal_threshold_;
+    params -> epoch = epoch;
+    return epoch >= 0 && params_epoch_ == epoch;
+}
+
+// PARTITION_STATIC and PARTITION_DYNAMIC: one fetch_add on the shared
+// counter claims grain_size indices.
+bool TaskState::claimShared(LaunchParams* params, int* begin, int* end){
+    // Cheap check first so idle threads only read the shared line.
+    uint64_t claim = next_task_.load();
+    if (int(claim >> EPOCH_SHIFT) != params -> epoch ||
+        int64_t(claim & INDEX_MASK) >= params -> num_total_tasks) {
+        return false;
+    }
+
+    int grain = params -> grain_size;
+    claim = next_task_.fetch_add(grain);
+    int epoch = int(claim >> EPOCH_SHIFT);
+    int64_t first = int64_t(claim & INDEX_MASK);
+
+    // The counter may have moved on to a newer launch since the parameters
+    // were read.  While this claim holds unrun tasks its launch cannot
+    // finish, so re-reading gives that launch's parameters; if they do not
+    // match, the claim's launch is already over and the claim is empty.
+    if (epoch != params -> epoch && (!readParams(params) || params -> epoch != epoch)) {
+        return false;
+    }
+    if (first >= params -> num_total_tasks) {
+        return false;
+    }
+    *begin = int(first);
+    *end = int(std::min(first + grain, int64_t(params -> num_total_tasks)));
+    return true;
+}
+
+// PARTITION_GUIDED: chunk size shrinks with the number of unclaimed
+// indices, so it needs a compare-and-swap rather than a fetch_add.
+bool TaskState::claimGuided(const LaunchParams& params, int* begin, int* end){
+    uint64_t claim = next_task_.load();
+    while (true) {
+        if (int(claim >> EPOCH_SHIFT) != params.epoch) {
+            return false;
+        }
+        int64_t first = int64_t(claim & INDEX_MASK);
+        int64_t left = params.num_total_tasks - first;
+        if (left <= 0) {
+            return false;
+        }
+        int64_t chunk = std::max(int64_t(params.grain_size), left / (2 * num_slots_));
+        chunk = std::min(chunk, left);
+        if (next_task_.compare_exchange_weak(claim, claim + chunk)) {
+            *begin = int(first);
+            *end = int(first + chunk);
+            return true;
+        }
+    }
+}
+
+// PARTITION_AUTO: take grain_size indices from this thread's own block.
+// Once it is empty, take the upper half of the first non-empty block of
+// another thread and keep what is not run right away as the new own block.
+bool TaskState::claimFromRanges(int slot, const LaunchParams& params, int* begin, int* end){
+    WorkerRange* own = ranges_[slot];
+    own -> mutex_.lock();
+    if (own -> epoch_ == params.epoch && own -> begin_ < own -> end_) {
+        *begin = own -> begin_;
+        *end = std::min(own -> begin_ + params.grain_size, own -> end_);
+        own -> begin_ = *end;
+        own -> mutex_.unlock();
+        return true;
+    }
+    own -> mutex_.unlock();
+
+    for (int i = 1; i < num_slots_; i++) {
+        WorkerRange* victim = ranges_[(slot + i) % num_slots_];
+        victim -> mutex_.lock();
+        if (victim -> epoch_ != params.epoch || victim -> begin_ >= victim -> end_) {
+            victim -> mutex_.unlock();
+            continue;
+        }
+        int stolen_begin = victim -> end_ - (victim -> end_ - victim -> begin_ + 1) / 2;
+        int stolen_end = victim -> end_;
+        victim -> end_ = stolen_begin;
+        victim -> mutex_.unlock();
+
+        *begin = stolen_begin;
+        *end = std::min(stolen_begin + params.grain_size, stolen_end);
+
+        // Nobody else adds to this block and the launch cannot be
+        // republished while we hold part of it, so this cannot race.
+        own -> mutex_.lock();
+        own -> epoch_ = params.epoch;
+        own -> begin_ = *end;
+        own -> end_ = stolen_end;
+        own -> mutex_.unlock();
+        return true;
+    }
+    return false;
+}
+
+// Fills the affinity queues for a new launch.  Each chunk goes back to the
+// thread that ran it last time; a launch of a new shape starts from one
+// contiguous block of chunks per thread.
+void TaskState::assignAffinityChunks(int num_total_tasks, int grain_size){
+    int num_chunks = (std::max(num_total_tasks, 0) + grain_size - 1) / grain_size;
+    if (num_total_tasks != affinity_tasks_ || grain_size != affinity_grain_) {
+        affinity_tasks_ = num_total_tasks;
+        affinity_grain_ = grain_size;
+        chunk_owner_.resize(num_chunks);
+        for (int c = 0; c < num_chunks; c++) {
+            chunk_owner_[c] = int(int64_t(c) * num_slots_ / num_chunks);
+        }
+    }
+
+    for (int i = 0; i < num_slots_; i++) {
+        AffinityQueue* queue = queues_[i];
+        std::lock_guard<std::mutex> lock(queue -> mutex_);
+        queue -> epoch_ = epoch_;
+        queue -> chunks_.clear();
+        queue -> head_ = 0;
+        queue -> tail_ = 0;
+    }
+    for (int c = 0; c < num_chunks; c++) {
+        AffinityQueue* queue = queues_[chunk_owner_[c]];
+        std::lock_guard<std::mutex> lock(queue -> mutex_);
+        queue -> chunks_.push_back(c);
+        queue -> tail_ ++;
+    }
+}
+
+// PARTITION_AFFINITY: take the next chunk from this thread's own queue.
+// Once it is empty, take the last chunk of the thread with the most chunks
+// left, provided that is more than steal_threshold.  The last slot is the
+// thread calling run(), which ignores the threshold so that a launch
+// always finishes even if some pool thread never wakes up for it.
+bool TaskState::claimAffinity(int slot, const LaunchParams& params, int* begin, int* end){
+    int chunk = -1;
+    AffinityQueue* own = queues_[slot];
+    own -> mutex_.lock();
+    if (own -> epoch_ == params.epoch && own -> head_ < own -> tail_) {
+        chunk = own -> chunks_[own -> head_++];
+    }
+    own -> mutex_.unlock();
+
+    while (chunk < 0) {
+        int threshold = slot == num_slots_ - 1 ? 0 : params.steal_threshold;
+        int victim = -1;
+        int most_left = threshold;
+        // Threads on the same node first, then everyone.
+        for (int pass = spans_nodes_ ? 0 : 1; pass < 2 && victim < 0; pass++) {
+            for (int i = 1; i < num_slots_; i++) {
+                int other = (slot + i) % num_slots_;
+                if (pass == 0 && slot_node_[other] != slot_node_[slot]) {
+                    continue;
+                }
+                AffinityQueue* queue = queues_[other];
+                std::lock_guard<std::mutex> lock(queue -> mutex_);
+                int left = queue -> epoch_ == params.epoch ? queue -> tail_ - queue -> head_ : 0;
+                if (left > most_left) {
+                    most_left = left;
+                    victim = other;
+                }
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+        AffinityQueue* queue = queues_[victim];
+        std::lock_guard<std::mutex> lock(queue -> mutex_);
+        if (queue -> epoch_ == params.epoch && queue -> tail_ - queue -> head_ > threshold) {
+            chunk = queue -> chunks_[-- queue -> tail_];
+        }
+    }
+
+    // Read by the next publish(), once this launch has finished.
+    chunk_owner_[chunk] = slot;
+    *begin = chunk * params.grain_size;
+    *end = std::min(*begin + params.grain_size, params.num_total_tasks);
+    return true;
+}
+
+// TaskState whose tasks the calling thread is running, if any.
+static thread_local TaskState* running_state = nullptr;
+
+// Claims and runs one chunk of the current launch on behalf of the thread
+// owning `slot`.  Returns false when there is nothing left to claim.
+bool TaskState::runNextChunk(int slot){
+    LaunchParams params;
+    if (!readParams(&params)) {
+        return false;
+    }
+
+    int begin;
+    int end;
+    bool claimed;
+    if (params.kind == PARTITION_AUTO) {
+        claimed = claimFromRanges(slot, params, &begin, &end);
+    } else if (params.kind == PARTITION_AFFINITY) {
+        claimed = claimAffinity(slot, params, &begin, &end);
+    } else if (params.kind == PARTITION_GUIDED) {
+        claimed = claimGuided(params, &begin, &end);
+    } else {
+        claimed = claimShared(&params, &begin, &end);
+    }
+    if (!claimed) {
+        return false;
+    }
+
+    TaskState* outer_state = running_state;
+    running_state = this;
+    if (!failed_) {
+        try {
+            for (int i = begin; i < end; i++) {
+                params.runnable -> runTask(i, params.num_total_tasks);
+            }
+        } catch (...) {
+            fail();
+        }
+    }
+    running_state = outer_state;
+
+    int count = end - begin;
+    if (finished_tasks_.fetch_add(count) + count == params.num_total_tasks) {
+        finished_mutex_ -> lock();
+        finished_mutex_ -> unlock();
+        finished_ -> notify_all();
+    }
+    return true;
+}
+
+// Records the exception being handled as the launch's, unless a task has
+// thrown already.  Called from a catch block.
+void TaskState::fail(){
+    std::lock_guard<std::mutex> lock(*finished_mutex_);
+    if (!error_) {
+        error_ = std::current_exception();
+    }
+    failed_ = true;
+}
+
+// Rethrows the exception of the launch that has just finished, if any.
+void TaskState::rethrowError(){
+    if (!failed_) {
+        return;
+    }
+    std::exception_ptr error;
+    finished_mutex_ -> lock();
+    error.swap(error_);
+    finished_mutex_ -> unlock();
+    std::rethrow_exception(error);
+}
+
+// True when called from inside a task of the current launch.
+bool TaskState::insideTask(){
+    return running_state == this;
+}
+
+// A launch made from inside a task of the pool's current launch.  The
+// pool tracks one launch at a time, so the calling thread runs the nested
+// one to completion itself rather than waiting for threads that are busy
+// with the outer launch.
+static void runNested(IRunnable* runnable, int num_total_tasks) {
+    for (int i = 0; i < num_total_tasks; i++) {
+        runnable -> runTask(i, num_total_tasks);
+    }
+}
+
+// Number of chunks the current launch splits into, counting a single
+// chunk per thread for PARTITION_GUIDED whose chunks shrink as it runs.
+int TaskState::numChunks(){
+    int num_total_tasks = num_total_tasks_;
+    if (num_total_tasks <= 0) {
+        return 0;
+    }
+    int kind = kind_;
+    if (kind == PARTITION_AUTO || kind == PARTITION_GUIDED) {
+        return std::min(num_total_tasks, num_slots_);
+    }
+    int grain_size = grain_size_;
+    return (num_total_tasks + grain_size - 1) / grain_size;
+}
+
+// True while the current launch still has indices nobody has claimed.
+bool TaskState::hasUnclaimed(){
+    LaunchParams params;
+    if (!readParams(&params)) {
+        return false;
+    }
+    if (params.kind == PARTITION_AFFINITY) {
+        for (int i = 0; i < num_slots_; i++) {
+            std::lock_guard<std::mutex> lock(queues_[i] -> mutex_);
+            if (queues_[i] -> epoch_ == params.epoch && queues_[i] -> head_ < queues_[i] -> tail_) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (params.kind != PARTITION_AUTO) {
+        uint64_t claim = next_task_;
+        return int(claim >> EPOCH_SHIFT) == params.epoch &&
+               int64_t(claim & INDEX_MASK) < params.num_total_tasks;
+    }
+    for (int i = 0; i < num_slots_; i++) {
+        std::lock_guard<std::mutex> lock(ranges_[i] -> mutex_);
+        if (ranges_[i] -> epoch_ == params.epoch && ranges_[i] -> begin_ < ranges_[i] -> end_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Blocks until every task of the current launch has finished, spinning
+// for up to spin_budget pause instructions before sleeping.
+void TaskState::waitUntilFinished(int spin_budget){
+    for (int i = 0; i < spin_budget && finished_tasks_ != num_total_tasks_; i++) {
+        cpuRelax();
+    }
+    std::unique_lock<std::mutex> lk(*finished_mutex_);
+    while (finished_tasks_ != num_total_tasks_) {
+        finished_ -> wait(lk);
+    }
+}
+
 const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads, bool count_caller_as_worker,
+                                                                           PinPolicy pin_policy): ITaskSystem(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
-    state_ = new TaskState;
+    if (count_caller_as_worker) {
+        num_threads = std::max(num_threads - 1, 0);
+    }
+    placement_ = Topology::system().place(pin_policy, num_threads);
+    state_ = new TaskState(num_threads + 1);
+    state_ -> setSlotNodes(placement_);
+    partitioner_ = Partitioner();
     killed = false;
     threads_pool_ = new std::thread[num_threads];
     num_threads_ = num_threads;
     for(int i = 0; i < num_threads; i++){
-        threads_pool_[i] = std::thread(&TaskSystemParallelThreadPoolSpinning::spinningThread, this);
+        threads_pool_[i] = std::thread(&TaskSystemParallelThreadPoolSpinning::spinningThread, this, i);
     }
 }
 
@@ -162,39 +642,27 @@ TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
     delete state_;
 }
 
-void TaskSystemParallelThreadPoolSpinning::spinningThread(){
-    int id;
-    int total;
+void TaskSystemParallelThreadPoolSpinning::spinningThread(int thread_id){
+    pinCurrentThread(placement_[thread_id].cpus);
     while(true){
         if(killed) break;
-
-        state_ -> mutex_ -> lock();
-        total = state_ -> num_total_tasks_;
-        id = state_ -> num_total_tasks_ - state_ -> left_tasks_;
-        if (id < total)
-            state_ -> left_tasks_ --;
-        state_ -> mutex_ -> unlock();
-
-        if (id < total){
-            state_ -> runnable_ -> runTask(id, total);
-
-            state_ -> mutex_ -> lock();
-            state_ -> finished_tasks_ ++;
-            if(state_ -> finished_tasks_ == total){
-                state_ -> mutex_ -> unlock();
-
-                state_ -> finished_mutex_ -> lock();
-                state_ -> finished_mutex_ -> unlock();
-                state_ -> finished_ -> notify_all();
-            } else {
-                state_ -> mutex_ -> unlock();
-            }
-        }
-
+        state_ -> runNextChunk(thread_id);
     }
 }
 
+void TaskSystemParallelThreadPoolSpinning::setPartitioner(const Partitioner& partitioner) {
+    partitioner_ = partitioner;
+}
+
 void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks) {
+    run(runnable, num_total_tasks, partitioner_);
+}
+
+void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks, int grain_size) {
+    run(runnable, num_total_tasks, Partitioner(PARTITION_DYNAMIC, grain_size));
+}
+
+void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner) {
 
 
     //
@@ -202,17 +670,17 @@ void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_tota
     // method in Part A.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
-    std::unique_lock<std::mutex> lk(*(state_ -> finished_mutex_));
-
-    state_ -> mutex_ -> lock();
-    state_ -> finished_tasks_ = 0;
-    state_ -> left_tasks_ = num_total_tasks;
-    state_ -> num_total_tasks_  = num_total_tasks;
-    state_ -> runnable_ = runnable;
-    state_ -> mutex_ -> unlock();
+    if (state_ -> insideTask()) {
+        runNested(runnable, num_total_tasks);
+        return;
+    }
+    state_ -> publish(runnable, num_total_tasks, partitioner);
 
-    state_ -> finished_ -> wait(lk);
-    lk.unlock();
+    // Work on the launch instead of idling until the pool is done.  The
+    // calling thread uses the slot after the pool threads.
+    while (state_ -> runNextChunk(num_threads_)) {}
+    state_ -> waitUntilFinished(0);
+    state_ -> rethrowError();
 }
 
 TaskID TaskSystemParallelThreadPoolSpinning::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
@@ -236,21 +704,35 @@ const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
+// Number of sched_yield() calls between spinning and parking under
+// WAIT_HYBRID.
+static const int HYBRID_YIELD_ROUNDS = 8;
+
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads, bool count_caller_as_worker,
+                                                                           WaitStrategy wait_strategy, int spin_budget,
+                                                                           PinPolicy pin_policy): ITaskSystem(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
+    if (count_caller_as_worker) {
+        num_threads = std::max(num_threads - 1, 0);
+    }
     killed = false;
-    state_ = new TaskState;
-    has_task_cv_ = new std::condition_variable;
-    has_task_mutex_ = new std::mutex;
+    spin_budget_ = wait_strategy == WAIT_HYBRID ? std::max(spin_budget, 0) : 0;
+    worker_words_ = new ParkingWord[std::max(num_threads, 1)];
+    idle_mutex_ = new std::mutex();
+    num_idle_ = 0;
+    placement_ = Topology::system().place(pin_policy, num_threads);
+    state_ = new TaskState(num_threads + 1);
+    state_ -> setSlotNodes(placement_);
+    partitioner_ = Partitioner();
     num_threads_ = num_threads;
     threads_pool_ = new std::thread[num_threads];
     for(int i = 0; i < num_threads; i++){
-        threads_pool_[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::sleepingThread, this);
+        threads_pool_[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::sleepingThread, this, i);
     }
 }
 
@@ -262,49 +744,105 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     // (requiring changes to tasksys.h).
     //
     killed = true;
-    has_task_cv_ -> notify_all();
+    for(int i = 0; i < num_threads_; i++){
+        worker_words_[i].bump();
+    }
     for(int i = 0; i < num_threads_; i++){
         threads_pool_[i].join();
     }
     delete state_;
-    delete has_task_cv_;
-    delete has_task_mutex_;
     delete[] threads_pool_;
+    delete[] worker_words_;
+    delete idle_mutex_;
+}
+
+// Pause instructions an idle thread spins for before it yields and parks;
+// zero under WAIT_SLEEP.
+int TaskSystemParallelThreadPoolSleeping::spinBudget() {
+    return spin_budget_;
 }
 
-void TaskSystemParallelThreadPoolSleeping::sleepingThread(){
-    int id;
-    int total;
+void TaskSystemParallelThreadPoolSleeping::sleepingThread(int thread_id){
+    pinCurrentThread(placement_[thread_id].cpus);
     while(true){
-        if (killed == true) break;
-        
-        state_ -> mutex_ -> lock();
-        total = state_ -> num_total_tasks_;
-        id = state_ -> num_total_tasks_ - state_ -> left_tasks_;
-        if (id < total) state_->left_tasks_--;
-        state_ -> mutex_ -> unlock();
-
-        if (id < total){
-            state_ -> runnable_ -> runTask(id, total);
-
-            state_ -> mutex_ -> lock();
-            state_ -> finished_tasks_ ++;
-            if(state_ -> finished_tasks_ == total){
-                state_ -> mutex_ -> unlock();
-                state_ -> finished_mutex_ -> lock();
-                state_ -> finished_mutex_ -> unlock();
-                state_ -> finished_ -> notify_all();
-            } else {
-                state_ -> mutex_ -> unlock();
+        // Read the word before checking killed so a shutdown bump between
+        // the two cannot be missed.
+        int seen_wake = worker_words_[thread_id].load();
+        if (killed) {
+            break;
+        }
+        while (state_ -> runNextChunk(thread_id)) {
+            if (num_idle_ > 0 && state_ -> hasUnclaimed()) {
+                wakeIdleWorkers(1);
             }
-        } else {
-            std::unique_lock<std::mutex> lk(*(has_task_mutex_));
-            has_task_cv_ -> wait(lk);
         }
+
+        idle_mutex_ -> lock();
+        idle_workers_.push_back(thread_id);
+        num_idle_ ++;
+        idle_mutex_ -> unlock();
+        // A launch published after the last claim failed but before this
+        // thread was on the list has not woken it; claim from it instead.
+        if (state_ -> hasUnclaimed()) {
+            idle_mutex_ -> lock();
+            auto it = std::find(idle_workers_.begin(), idle_workers_.end(), thread_id);
+            if (it != idle_workers_.end()) {
+                idle_workers_.erase(it);
+                num_idle_ --;
+            }
+            idle_mutex_ -> unlock();
+            continue;
+        }
+        waitForWake(thread_id, seen_wake);
+    }
+}
+
+// Returns once another thread has woken `thread_id` after `seen_wake` or
+// the pool is shutting down.
+void TaskSystemParallelThreadPoolSleeping::waitForWake(int thread_id, int seen_wake){
+    ParkingWord& word = worker_words_[thread_id];
+    for (int i = 0; i < spin_budget_ && word.load() == seen_wake; i++) {
+        cpuRelax();
+    }
+    if (spin_budget_ > 0) {
+        for (int i = 0; i < HYBRID_YIELD_ROUNDS && word.load() == seen_wake; i++) {
+            std::this_thread::yield();
+        }
+    }
+    while (word.load() == seen_wake) {
+        word.park(seen_wake);
     }
 }
 
+// Wakes up to `count` idle threads, most recently idle first since their
+// caches are the warmest.
+void TaskSystemParallelThreadPoolSleeping::wakeIdleWorkers(int count){
+    if (count <= 0 || num_idle_ == 0) {
+        return;
+    }
+    idle_mutex_ -> lock();
+    while (count > 0 && !idle_workers_.empty()) {
+        worker_words_[idle_workers_.back()].bump();
+        idle_workers_.pop_back();
+        num_idle_ --;
+        count--;
+    }
+    idle_mutex_ -> unlock();
+}
+
+void TaskSystemParallelThreadPoolSleeping::setPartitioner(const Partitioner& partitioner) {
+    partitioner_ = partitioner;
+}
+
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
+    run(runnable, num_total_tasks, partitioner_);
+}
+
+void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks, int grain_size) {
+    run(runnable, num_total_tasks, Partitioner(PARTITION_DYNAMIC, grain_size));
+}
+
+void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner) {
 
 
     //
@@ -312,18 +850,19 @@ void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_tota
     // method in Parts A and B.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
-    std::unique_lock<std::mutex> lk(*(state_ -> finished_mutex_));
-
-    state_ -> mutex_ -> lock();
-    state_ -> finished_tasks_ = 0;
-    state_ -> left_tasks_ = num_total_tasks;
-    state_ -> num_total_tasks_ = num_total_tasks;
-    state_ -> runnable_ = runnable;
-    state_ -> mutex_ -> unlock();
-
-    has_task_cv_ -> notify_all();
-
-    state_ -> finished_ -> wait(lk);
+    if (state_ -> insideTask()) {
+        runNested(runnable, num_total_tasks);
+        return;
+    }
+    state_ -> publish(runnable, num_total_tasks, partitioner);
+    // The calling thread takes one chunk itself.
+    wakeIdleWorkers(state_ -> numChunks() - 1);
+
+    // Work on the launch instead of idling until the pool is done.  The
+    // calling thread uses the slot after the pool threads.
+    while (state_ -> runNextChunk(num_threads_)) {}
+    state_ -> waitUntilFinished(spin_budget_);
+    state_ -> rethrowError();
 }
 
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
@@ -345,3 +884,75 @@ void TaskSystemParallelThreadPoolSleeping::sync() {
 
     return;
 }
+
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Work-Stealing Task System Implementation
+ * ================================================================
+ */
+
+// Named as a serial stub so runtasks does not time it as a parallel pool.
+const char* TaskSystemParallelThreadPoolStealing::name() {
+    return "Serial stub of Thread Pool + Steal";
+}
+
+TaskSystemParallelThreadPoolStealing::TaskSystemParallelThreadPoolStealing(int num_threads): ITaskSystem(num_threads) {
+    // NOTE: the work-stealing task system is implemented in Part B.
+}
+
+TaskSystemParallelThreadPoolStealing::~TaskSystemParallelThreadPoolStealing() {}
+
+void TaskSystemParallelThreadPoolStealing::run(IRunnable* runnable, int num_total_tasks) {
+    // NOTE: the work-stealing task system is implemented in Part B.
+    for (int i = 0; i < num_total_tasks; i++) {
+        runnable->runTask(i, num_total_tasks);
+    }
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
+    // You do not need to implement this method.
+    return 0;
+}
+
+void TaskSystemParallelThreadPoolStealing::sync() {
+    // You do not need to implement this method.
+    return;
+}
+
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Fiber Task System Implementation
+ * ================================================================
+ */
+
+// Named as a serial stub so runtasks does not time it as a parallel pool.
+const char* TaskSystemParallelThreadPoolFibers::name() {
+    return "Serial stub of Thread Pool + Fibers";
+}
+
+TaskSystemParallelThreadPoolFibers::TaskSystemParallelThreadPoolFibers(int num_threads): ITaskSystem(num_threads) {
+    // NOTE: the fiber task system is implemented in Part B.
+}
+
+TaskSystemParallelThreadPoolFibers::~TaskSystemParallelThreadPoolFibers() {}
+
+void TaskSystemParallelThreadPoolFibers::run(IRunnable* runnable, int num_total_tasks) {
+    // NOTE: the fiber task system is implemented in Part B.
+    for (int i = 0; i < num_total_tasks; i++) {
+        runnable->runTask(i, num_total_tasks);
+    }
+}
+
+TaskID TaskSystemParallelThreadPoolFibers::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                            const std::vector<TaskID>& deps) {
+    // You do not need to implement this method.
+    return 0;
+}
+
+void TaskSystemParallelThreadPoolFibers::sync() {
+    // You do not need to implement this method.
+    return;
+}
@@ -2,7 +2,13 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
+#include "ParkingWord.h"
+#include "Topology.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <thread>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 
@@ -30,7 +36,6 @@ class TaskSystemSerial: public ITaskSystem {
  */
 class TaskSystemParallelSpawn: public ITaskSystem {
     private:
-        std::thread* threads_pool_;
         int num_threads_;
     public:
         TaskSystemParallelSpawn(int num_threads);
@@ -40,64 +45,270 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
-        void threadRun(IRunnable* runnable, int num_total_tasks, std::mutex* mtx, int* curr_task);
+        void threadRun(IRunnable* runnable, int num_total_tasks, std::mutex* mtx, int* curr_task,
+                       std::exception_ptr* error);
 };
 
 /*
- * TaskSystemParallelThreadPoolSpinning: This class is the student's
- * implementation of a parallel task execution engine that uses a
- * thread pool. See definition of ITaskSystem in itasksys.h for
- * documentation of the ITaskSystem interface.
+ * Partitioner: policy for splitting the task indices of a launch.
+ *
+ *  - PARTITION_STATIC: one contiguous block per thread.
+ *  - PARTITION_DYNAMIC: chunks of grain_size indices from a shared
+ *    counter.  A grain_size of zero picks one from num_total_tasks and
+ *    the number of threads.
+ *  - PARTITION_GUIDED: chunks proportional to the number of unclaimed
+ *    indices, never smaller than grain_size.
+ *  - PARTITION_AUTO: every thread starts with a block of its own and a
+ *    thread that runs out takes half of another thread's remaining block.
+ *  - PARTITION_AFFINITY: chunks of grain_size indices go to the thread
+ *    that ran them in the previous launch of the same shape, so repeated
+ *    launches over the same data keep it in the same caches.  A thread
+ *    that runs out only steals from threads with more than
+ *    steal_threshold chunks left (zero picks a default), trying threads
+ *    on its own NUMA node before those on other nodes.
  */
+enum PartitionerKind {
+    PARTITION_STATIC,
+    PARTITION_DYNAMIC,
+    PARTITION_GUIDED,
+    PARTITION_AUTO,
+    PARTITION_AFFINITY,
+};
+
+class Partitioner {
+    public:
+        PartitionerKind kind;
+        int grain_size;
+        int steal_threshold;
+        Partitioner(PartitionerKind kind = PARTITION_DYNAMIC, int grain_size = 0, int steal_threshold = 0)
+            : kind(kind), grain_size(grain_size), steal_threshold(steal_threshold) {}
+};
+
+/*
+ * Consistent snapshot of the parameters of the current launch.
+ */
+class LaunchParams {
+    public:
+        int epoch;
+        PartitionerKind kind;
+        IRunnable* runnable;
+        int num_total_tasks;
+        int grain_size;
+        int steal_threshold;
+};
+
+/*
+ * WorkerRange: the block of task indices a thread still owns under
+ * PARTITION_AUTO.  Guarded by its own mutex, which is only contended
+ * when another thread comes to steal.
+ */
+class WorkerRange {
+    public:
+        std::mutex mutex_;
+        int epoch_;
+        int begin_;
+        int end_;
+        WorkerRange() : epoch_(-1), begin_(0), end_(0) {}
+};
+
+/*
+ * AffinityQueue: the chunks a thread is to run under PARTITION_AFFINITY,
+ * claimed from head_ by the owner and stolen from tail_ by others.
+ */
+class AffinityQueue {
+    public:
+        std::mutex mutex_;
+        int epoch_;
+        std::vector<int> chunks_;
+        int head_;
+        int tail_;
+        AffinityQueue() : epoch_(-1), head_(0), tail_(0) {}
+};
+
 class TaskState {
     public:
-        std::mutex* mutex_;
         std::condition_variable* finished_;
         std::mutex* finished_mutex_;
-        IRunnable* runnable_;
-        int finished_tasks_;
-        int left_tasks_;
-        int num_total_tasks_;
-        TaskState();
+        // Launch epoch in the top bits, next unclaimed task index below.
+        std::atomic<uint64_t> next_task_;
+        // Epoch the launch parameters belong to, -1 while they are rewritten.
+        std::atomic<int> params_epoch_;
+        std::atomic<int> kind_;
+        std::atomic<IRunnable*> runnable_;
+        std::atomic<int> num_total_tasks_;
+        std::atomic<int> grain_size_;
+        std::atomic<int> steal_threshold_;
+        std::atomic<int> finished_tasks_;
+        // Set once a task of the launch has thrown; later chunks are
+        // counted as finished without running.  error_ is the first
+        // exception and is guarded by finished_mutex_.
+        std::atomic<bool> failed_;
+        std::exception_ptr error_;
+        int epoch_;
+        int num_slots_;
+        WorkerRange** ranges_;
+        AffinityQueue** queues_;
+        // Slot that last ran each chunk, for launches of affinity_tasks_
+        // tasks in chunks of affinity_grain_.
+        std::vector<int> chunk_owner_;
+        int affinity_tasks_;
+        int affinity_grain_;
+        // NUMA node of each slot, -1 where unknown.
+        std::vector<int> slot_node_;
+        bool spans_nodes_;
+        TaskState(int num_slots);
         ~TaskState();
+        void setSlotNodes(const std::vector<WorkerPlacement>& placement);
+        void publish(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner);
+        bool readParams(LaunchParams* params);
+        bool claimShared(LaunchParams* params, int* begin, int* end);
+        bool claimGuided(const LaunchParams& params, int* begin, int* end);
+        bool claimFromRanges(int slot, const LaunchParams& params, int* begin, int* end);
+        void assignAffinityChunks(int num_total_tasks, int grain_size);
+        bool claimAffinity(int slot, const LaunchParams& params, int* begin, int* end);
+        bool runNextChunk(int slot);
+        void fail();
+        void rethrowError();
+        bool insideTask();
+        int numChunks();
+        bool hasUnclaimed();
+        void waitUntilFinished(int spin_budget);
 };
 
+/*
+ * TaskSystemParallelThreadPoolSpinning: This class is the student's
+ * implementation of a parallel task execution engine that uses a
+ * thread pool. See definition of ITaskSystem in itasksys.h for
+ * documentation of the ITaskSystem interface.
+ *
+ * The thread calling run() executes tasks alongside the pool.  When
+ * count_caller_as_worker is set, that thread counts towards num_threads
+ * and only num_threads - 1 pool threads are created.
+ *
+ * How task indices are handed out is chosen by a Partitioner, either per
+ * launch through the three-argument run() or for every launch through
+ * setPartitioner().  The default is PARTITION_DYNAMIC with an automatic
+ * grain size.
+ *
+ * pin_policy places the pool threads on CPUs (see Topology.h).  The
+ * calling thread is never pinned.
+ *
+ * run() may be called from inside a task of the pool's current launch.
+ * The nested launch then runs to completion on the calling thread.
+ */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     private:
         TaskState* state_;
         std::thread* threads_pool_;
         bool killed;
         int num_threads_;
+        std::vector<WorkerPlacement> placement_;
+        Partitioner partitioner_;
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads, bool count_caller_as_worker = false,
+                                             PinPolicy pin_policy = PIN_NONE);
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
-        void spinningThread();
+        void spinningThread(int thread_id);
+        void setPartitioner(const Partitioner& partitioner);
         void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, int grain_size);
+        void run(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
 };
 
+/*
+ * WaitStrategy: how idle threads of the sleeping pool wait for work.
+ *
+ *  - WAIT_SLEEP: park straight away until the next launch.
+ *  - WAIT_HYBRID: spin for spin_budget pause instructions, then yield a
+ *    few times, and only then park.  run() likewise spins on the launch
+ *    before blocking.  Suits bursts of launches separated by idle gaps.
+ */
+enum WaitStrategy {
+    WAIT_SLEEP,
+    WAIT_HYBRID,
+};
+
+#define DEFAULT_SPIN_BUDGET 2048
+
 /*
  * TaskSystemParallelThreadPoolSleeping: This class is the student's
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * As with the spinning pool, the calling thread helps run each launch,
+ * count_caller_as_worker sizes the pool to num_threads - 1, pin_policy
+ * places the pool threads and a nested run() runs on the calling thread.
+ *
+ * Idle threads wait according to wait_strategy (see WaitStrategy).  They
+ * push their id on idle_workers_ and wait on a parking word of their own.
+ * run() wakes only as many of them as the launch has chunks beyond the
+ * one the caller takes, and a thread that finishes a chunk while others
+ * are still unclaimed wakes the next idle thread.
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     private:
         TaskState* state_;
         std::thread* threads_pool_;
-        bool killed;
+        std::atomic<bool> killed;
         int num_threads_;
-        std::condition_variable* has_task_cv_;
-        std::mutex* has_task_mutex_;
+        int spin_budget_;
+        ParkingWord* worker_words_;
+        std::mutex* idle_mutex_;
+        std::vector<int> idle_workers_;
+        std::atomic<int> num_idle_;
+        std::vector<WorkerPlacement> placement_;
+        Partitioner partitioner_;
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads, bool count_caller_as_worker = false,
+                                             WaitStrategy wait_strategy = WAIT_SLEEP,
+                                             int spin_budget = DEFAULT_SPIN_BUDGET,
+                                             PinPolicy pin_policy = PIN_NONE);
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
-        void sleepingThread();
+        int spinBudget();
+        void sleepingThread(int thread_id);
+        void waitForWake(int thread_id, int seen_wake);
+        void wakeIdleWorkers(int count);
+        void setPartitioner(const Partitioner& partitioner);
+        void run(IRunnable* runnable, int num_total_tasks);
+        void run(IRunnable* runnable, int num_total_tasks, int grain_size);
+        void run(IRunnable* runnable, int num_total_tasks, const Partitioner& partitioner);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+};
+
+/*
+ * TaskSystemParallelThreadPoolStealing: work-stealing thread pool.  It is
+ * implemented in Part B; the Part A version runs launches serially so the
+ * shared test driver can be built against either part.
+ */
+class TaskSystemParallelThreadPoolStealing: public ITaskSystem {
+    public:
+        TaskSystemParallelThreadPoolStealing(int num_threads);
+        ~TaskSystemParallelThreadPoolStealing();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+};
+
+/*
+ * TaskSystemParallelThreadPoolFibers: M:N task system running tasks on
+ * fibers.  It is implemented in Part B; the Part A version runs launches
+ * serially so the shared test driver can be built against either part.
+ */
+class TaskSystemParallelThreadPoolFibers: public ITaskSystem {
+    public:
+        TaskSystemParallelThreadPoolFibers(int num_threads);
+        ~TaskSystemParallelThreadPoolFibers();
+        const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
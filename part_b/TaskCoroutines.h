@@ -0,0 +1,167 @@
+#ifndef _TASK_COROUTINES_H
+#define _TASK_COROUTINES_H
+
+#include "itasksys.h"
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define TASKSYS_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef TASKSYS_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+/*
+ * C++20 coroutine front end for the task systems.  Needs -std=c++20; the
+ * rest of the tree builds as C++11 and this header is empty there.
+ *
+ *     DetachedCoroutine pipeline(AwaitableTaskSystem sys) {
+ *         TaskID a = co_await sys.launch(&stage_a, n);
+ *         co_await sys.launch(&stage_b, n, {a});
+ *     }
+ *
+ * Awaiting a launch that has not finished suspends the coroutine and
+ * submits a one-task continuation launch that depends on it.  A pool
+ * thread resumes the coroutine by running that launch, so no thread is
+ * blocked while a stage runs.  A suspended coroutine is thus always
+ * represented by a pending launch, and sync() returns only once every
+ * coroutine has run to completion.  The sleeping pool's sync() also runs
+ * ready launches on its caller, so there a continuation may resume on the
+ * thread calling sync() instead.
+ *
+ * co_await rethrows the exception of a failed launch, as wait() does, and
+ * throws LaunchCancelled for a cancelled launch the coroutine had to wait
+ * for; one that had already finished when awaited just counts as done.
+ * Continuations run even then, so a suspended coroutine is always
+ * resumed.  A detached coroutine that lets LaunchCancelled escape ends
+ * quietly, and any other exception it lets escape terminates the program.
+ *
+ * With task systems that run launches synchronously the awaited launch is
+ * already done and the coroutine simply carries on.  Launches cannot be
+ * awaited while the sleeping pool is capturing a graph.
+ */
+
+/*
+ * LaunchCancelled: thrown into a coroutine whose awaited launch was
+ * cancelled.
+ */
+class LaunchCancelled: public std::exception {
+    public:
+        const char* what() const noexcept {
+            return "awaited launch was cancelled";
+        }
+};
+
+/*
+ * ResumeRunnable: single-task runnable that resumes a suspended coroutine.
+ * Cancelling or failing the awaited launch cancels the continuation too;
+ * it still runs, and tells the coroutine.
+ */
+class ResumeRunnable: public IRunnable {
+    public:
+        std::coroutine_handle<> handle;
+        bool cancelled = false;
+
+        bool runsWhenCancelled() {
+            return true;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            cancelled = isCancelled();
+            // The resumed coroutine may destroy this object, which lives in
+            // its frame, so nothing may touch it afterwards.
+            std::coroutine_handle<> resumed = handle;
+            resumed.resume();
+        }
+};
+
+/*
+ * LaunchAwaitable: result of AwaitableTaskSystem::launch().  co_await on
+ * it yields the TaskID once the launch has finished.
+ */
+class LaunchAwaitable {
+    public:
+        ITaskSystem* system;
+        TaskID task_id;
+        bool suspended = false;
+        ResumeRunnable resumer;
+
+        LaunchAwaitable(ITaskSystem* system, TaskID task_id) : system(system), task_id(task_id) {}
+
+        bool await_ready() {
+            return system -> isDone(task_id);
+        }
+
+        // The continuation may resume the coroutine on another thread
+        // before runAsyncWithDeps() returns, so this must not touch the
+        // awaitable after submitting it.
+        void await_suspend(std::coroutine_handle<> handle) {
+            suspended = true;
+            resumer.handle = handle;
+            system -> runAsyncWithDeps(&resumer, 1, std::vector<TaskID>{task_id});
+        }
+
+        // A continuation that was not cancelled means the launch neither
+        // failed nor was cancelled, so only the other cases need wait().
+        TaskID await_resume() {
+            if (!suspended || resumer.cancelled) {
+                system -> wait(task_id);
+            }
+            if (resumer.cancelled) {
+                throw LaunchCancelled();
+            }
+            return task_id;
+        }
+};
+
+/*
+ * AwaitableTaskSystem: submits launches to a task system and returns them
+ * as awaitables.
+ */
+class AwaitableTaskSystem {
+    public:
+        ITaskSystem* system;
+
+        AwaitableTaskSystem(ITaskSystem* system) : system(system) {}
+
+        LaunchAwaitable launch(IRunnable* runnable, int num_total_tasks,
+                               const std::vector<TaskID>& deps = std::vector<TaskID>()) {
+            return LaunchAwaitable(system, system -> runAsyncWithDeps(runnable, num_total_tasks, deps));
+        }
+
+        // Awaits a launch that was submitted some other way.
+        LaunchAwaitable after(TaskID task_id) {
+            return LaunchAwaitable(system, task_id);
+        }
+};
+
+/*
+ * DetachedCoroutine: return type of a coroutine that starts running when
+ * called and frees itself when it finishes.  Wait for it with sync().
+ */
+class DetachedCoroutine {
+    public:
+        class promise_type {
+            public:
+                DetachedCoroutine get_return_object() { return DetachedCoroutine(); }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() {
+                    try {
+                        throw;
+                    } catch (const LaunchCancelled&) {
+                    } catch (...) {
+                        std::terminate();
+                    }
+                }
+        };
+};
+
+#endif
+
+#endif
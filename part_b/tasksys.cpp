@@ -1,11 +1,42 @@
 #include "tasksys.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 IRunnable::~IRunnable() {}
 
+bool IRunnable::runsWhenCancelled() {
+    return false;
+}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+void ITaskSystem::wait(const std::vector<TaskID>& task_ids) {
+    sync();
+}
+
+bool ITaskSystem::isDone(TaskID task_id) {
+    return true;
+}
+
+TaskID ITaskSystem::runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                     const std::vector<TaskID>& deps) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void ITaskSystem::cancel(TaskID task_id) {}
+
+void ITaskSystem::beginBlocking() {}
+void ITaskSystem::endBlocking() {}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -116,30 +147,535 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
     return;
 }
 
+/*
+ * ================================================================
+ * Launch Table Implementation
+ * ================================================================
+ */
+
+static const int TASK_SLOT_BITS = 32;
+static const TaskID TASK_SLOT_MASK = (TaskID(1) << TASK_SLOT_BITS) - 1;
+// Generations wrap before they reach the sign bit, so ids stay positive.
+static const TaskID TASK_GENERATION_MASK = (TaskID(1) << 31) - 1;
+
+LaunchTable::LaunchTable() {
+    directory = nullptr;
+    num_blocks = 0;
+    directory_size = 0;
+    table_mutex = new std::mutex();
+}
+
+LaunchTable::~LaunchTable() {
+    Task** blocks = directory;
+    for (int b = 0; b < num_blocks; b++) {
+        for (int i = 0; i < LAUNCH_TABLE_BLOCK; i++) {
+            blocks[b][i].~Task();
+        }
+        free(blocks[b]);
+    }
+    delete[] blocks;
+    for (auto retired : retired_directories) {
+        delete[] retired;
+    }
+    delete table_mutex;
+}
+
+// Takes a record from the free list, or adds a block of records when
+// every record is in use.
+Task* LaunchTable::allocate(IRunnable* runnable, int num_total_tasks) {
+    std::lock_guard<std::mutex> lock(*table_mutex);
+    if (free_slots.empty()) {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, alignof(Task), sizeof(Task) * LAUNCH_TABLE_BLOCK) != 0) {
+            throw std::bad_alloc();
+        }
+        Task* block = static_cast<Task*>(memory);
+        int first = capacity();
+        for (int i = LAUNCH_TABLE_BLOCK - 1; i >= 0; i--) {
+            new (block + i) Task(TaskID(first + i));
+            free_slots.push_back(first + i);
+        }
+
+        int used = num_blocks;
+        Task** blocks = directory;
+        if (used == directory_size) {
+            directory_size = std::max(2 * directory_size, 8);
+            Task** grown = new Task*[directory_size];
+            std::copy(blocks, blocks + used, grown);
+            if (blocks != nullptr) {
+                retired_directories.push_back(blocks);
+            }
+            blocks = grown;
+            directory.store(blocks, std::memory_order_release);
+        }
+        blocks[used] = block;
+        num_blocks.store(used + 1, std::memory_order_release);
+    }
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    Task* task = &directory.load()[slot / LAUNCH_TABLE_BLOCK][slot % LAUNCH_TABLE_BLOCK];
+    task -> reuse(runnable, num_total_tasks);
+    return task;
+}
+
+// Returns the record in the slot `task_id` refers to, or nullptr if there
+// is no such slot.  The record may since have been recycled for another
+// launch.  Takes no lock.
+Task* LaunchTable::find(TaskID task_id) {
+    TaskID slot = task_id & TASK_SLOT_MASK;
+    int used = num_blocks.load(std::memory_order_acquire);
+    if (task_id < 0 || slot >= TaskID(used) * LAUNCH_TABLE_BLOCK) {
+        return nullptr;
+    }
+    Task** blocks = directory.load(std::memory_order_acquire);
+    return &blocks[slot / LAUNCH_TABLE_BLOCK][slot % LAUNCH_TABLE_BLOCK];
+}
+
+// Returns the record of a finished launch to the free list.  Successors
+// never point back at their predecessors, and every index has run, so
+// nothing but the table refers to it any more.
+void LaunchTable::release(Task* task) {
+    TaskID slot = task -> id & TASK_SLOT_MASK;
+    TaskID generation = ((task -> id >> TASK_SLOT_BITS) + 1) & TASK_GENERATION_MASK;
+    task -> successors_mutex.lock();
+    task -> id = (generation << TASK_SLOT_BITS) | slot;
+    task -> successors_mutex.unlock();
+
+    std::lock_guard<std::mutex> lock(*table_mutex);
+    free_slots.push_back(int(slot));
+}
+
+int LaunchTable::capacity() {
+    return num_blocks * LAUNCH_TABLE_BLOCK;
+}
+
+/*
+ * ================================================================
+ * Launch Error Implementation
+ * ================================================================
+ */
+
+LaunchErrors::LaunchErrors() {
+    unreported = nullptr;
+    any_failed = false;
+    errors_mutex = new std::mutex();
+}
+
+LaunchErrors::~LaunchErrors() {
+    for (auto& entry : failed) {
+        entry.second -> release();
+    }
+    if (unreported != nullptr) {
+        unreported -> release();
+    }
+    delete errors_mutex;
+}
+
+// Called as failed launch `task_id` finishes, before it counts as done.
+void LaunchErrors::recordFailure(TaskID task_id, LaunchError* error) {
+    std::lock_guard<std::mutex> lock(*errors_mutex);
+    if (error -> reported) {
+        return;
+    }
+    // Graph nodes have no id to wait() for.
+    if (task_id >= 0) {
+        error -> retain();
+        LaunchError*& entry = failed[task_id];
+        if (entry != nullptr) {
+            entry -> release();
+        }
+        entry = error;
+    }
+    if (unreported == nullptr) {
+        error -> retain();
+        unreported = error;
+    }
+    any_failed = true;
+}
+
+// The exception of finished launch `task_id` if it failed, or nullptr.
+// The caller releases the reference it gets.
+LaunchError* LaunchErrors::failureOf(TaskID task_id) {
+    if (!any_failed) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(*errors_mutex);
+    auto it = failed.find(task_id);
+    if (it == failed.end()) {
+        return nullptr;
+    }
+    it -> second -> retain();
+    return it -> second;
+}
+
+// Rethrows the exception of the first failed launch among `task_ids`.
+// Every launch that failed with it is forgotten, and sync() does not
+// report it again.
+void LaunchErrors::rethrowFor(const std::vector<TaskID>& task_ids) {
+    if (!any_failed) {
+        return;
+    }
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(*errors_mutex);
+        LaunchError* error = nullptr;
+        for (auto task_id : task_ids) {
+            auto it = failed.find(task_id);
+            if (it != failed.end()) {
+                error = it -> second;
+                break;
+            }
+        }
+        if (error == nullptr) {
+            return;
+        }
+        exception = error -> exception;
+        error -> reported = true;
+        // The launches cancelled by a failure share its entry.
+        for (auto it = failed.begin(); it != failed.end();) {
+            if (it -> second == error) {
+                error -> release();
+                it = failed.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (unreported == error) {
+            error -> release();
+            unreported = nullptr;
+        }
+        any_failed = !failed.empty() || unreported != nullptr;
+    }
+    std::rethrow_exception(exception);
+}
+
+// Rethrows the first exception not reported yet, and forgets every
+// failure so far.
+void LaunchErrors::rethrowUnreported() {
+    if (!any_failed) {
+        return;
+    }
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(*errors_mutex);
+        if (unreported != nullptr) {
+            exception = unreported -> exception;
+            unreported -> release();
+            unreported = nullptr;
+        }
+        for (auto& entry : failed) {
+            entry.second -> release();
+        }
+        failed.clear();
+        any_failed = false;
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+// Makes the exception being handled the failure of `task`, unless another
+// of its tasks failed first, and drops the launch's unclaimed indices the
+// way cancel() does.  Called from a catch block.
+static void failLaunch(Task* task) {
+    LaunchError* error = new LaunchError(std::current_exception());
+    LaunchError* none = nullptr;
+    if (!task -> error.compare_exchange_strong(none, error)) {
+        error -> release();
+    }
+    task -> cancelled = true;
+}
+
+// Whether the tasks of `task` still run once it is cancelled.  Launches
+// without a runnable, such as those of whenAll() and whenAny(), have no
+// tasks to run and are dropped.
+static bool runsWhenCancelled(Task* task) {
+    return task -> runnable != nullptr && task -> runnable -> runsWhenCancelled();
+}
+
+// Cancels `successor` of a cancelled launch, passing on the exception if
+// that launch failed and the successor's tasks are dropped.  The caller
+// makes sure the successor cannot have finished yet.
+static void cancelSuccessor(Task* successor, LaunchError* error) {
+    if (error != nullptr && !runsWhenCancelled(successor)) {
+        LaunchError* none = nullptr;
+        error -> retain();
+        if (!successor -> error.compare_exchange_strong(none, error)) {
+            error -> release();
+        }
+    }
+    successor -> cancelled = true;
+}
+
+// Fails `task` as well if launch `dep`, which has already finished,
+// failed.
+static void inheritFailure(LaunchErrors& errors, Task* task, TaskID dep) {
+    if (LaunchError* error = errors.failureOf(dep)) {
+        cancelSuccessor(task, error);
+        error -> release();
+    }
+}
+
+// Lets go of the exception `task` failed with, if any, once it has been
+// recorded and passed on.
+static void releaseFailure(Task* task) {
+    if (LaunchError* error = task -> error.exchange(nullptr)) {
+        error -> release();
+    }
+}
+
+/*
+ * ================================================================
+ * Task Graph Implementation
+ * ================================================================
+ */
+
+TaskGraph::TaskGraph(const std::vector<CapturedLaunch>& captured) {
+    num_nodes = int(captured.size());
+    running_nodes = 0;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, alignof(Task), sizeof(Task) * std::max(num_nodes, 1)) != 0) {
+        throw std::bad_alloc();
+    }
+    nodes = static_cast<Task*>(memory);
+    in_degrees.assign(num_nodes, 0);
+
+    for (int i = 0; i < num_nodes; i++) {
+        Task* node = new (nodes + i) Task(TaskID(-1));
+        node -> reuse(captured[i].runnable, captured[i].num_total_tasks);
+        node -> cost = captured[i].cost;
+        node -> graph = this;
+        for (int dep : captured[i].deps) {
+            nodes[dep].successors.push_back(node);
+            in_degrees[i]++;
+        }
+        if (in_degrees[i] == 0) {
+            roots.push_back(i);
+        }
+    }
+
+    // Captured launches are in submission order, which is topological, so
+    // one backwards pass gives exact bottom levels.
+    for (int i = num_nodes - 1; i >= 0; i--) {
+        double longest = 0;
+        for (Task* successor : nodes[i].successors) {
+            longest = std::max(longest, successor -> bottom_level.load());
+        }
+        nodes[i].bottom_level = nodes[i].cost + longest;
+    }
+}
+
+TaskGraph::~TaskGraph() {
+    for (int i = 0; i < num_nodes; i++) {
+        nodes[i].~Task();
+    }
+    free(nodes);
+}
+
+/*
+ * ================================================================
+ * Nested Launch Tracking
+ * ================================================================
+ */
+
+/*
+ * NestedFrame: the launches submitted from inside one running task.  A
+ * sync() made from that task waits for these alone, since waiting for
+ * every launch would include the one the task itself belongs to.
+ */
+class NestedFrame {
+    public:
+        ITaskSystem* system;
+        Task* task;
+        std::vector<TaskID> children;
+        NestedFrame* outer;
+};
+
+static thread_local NestedFrame* nested_frame = nullptr;
+
+// Runs one task of `task` with a frame of its own for nested launches.
+// An exception thrown by the task fails its launch instead of leaving the
+// pool thread.
+static void runTaskInFrame(ITaskSystem* system, Task* task, int index) {
+    NestedFrame frame;
+    frame.system = system;
+    frame.task = task;
+    frame.outer = nested_frame;
+    nested_frame = &frame;
+    try {
+        task -> runnable -> runTask(index, task -> num_total_tasks);
+    } catch (...) {
+        failLaunch(task);
+    }
+    nested_frame = frame.outer;
+}
+
+// The frame of the task of `system` the calling thread is running, if any.
+static NestedFrame* currentFrame(ITaskSystem* system) {
+    return nested_frame != nullptr && nested_frame -> system == system ? nested_frame : nullptr;
+}
+
+BlockingRegion::BlockingRegion() {
+    system_ = nested_frame != nullptr ? nested_frame -> system : nullptr;
+    if (system_ != nullptr) {
+        system_ -> beginBlocking();
+    }
+}
+
+BlockingRegion::~BlockingRegion() {
+    if (system_ != nullptr) {
+        system_ -> endBlocking();
+    }
+}
+
+/*
+ * ================================================================
+ * Any-Of Dependencies
+ * ================================================================
+ */
+
+/*
+ * A launch from runAsyncAfterAny() is on the successor list of each of
+ * its predecessors but holds a single count for all of them.  Whoever
+ * clears any_armed first, a finishing predecessor or the submitter
+ * finding a dependency already done, takes that count.  It first unlinks
+ * the launch from the other predecessors, so none of them touches the
+ * record once the launch has run and been recycled.
+ *
+ * Locks are taken launch first, then predecessor.
+ */
+
+// Removes `task` from the successor lists of its unfinished
+// predecessors.  Called with task's successors_mutex held.
+static void detachAny(Task* task) {
+    for (TaskRef pred : task -> predecessors) {
+        std::lock_guard<std::mutex> lock(pred.task -> successors_mutex);
+        if (pred.task -> id == pred.id && !pred.task -> finished) {
+            pred.task -> successors.remove(task);
+        }
+    }
+}
+
+// Adds the edges of an any-of launch.  The caller holds one count of
+// unfinished_deps, as for runAsyncWithDeps(); on return the launch holds
+// another until a predecessor finishes, unless one already has.  A
+// failed predecessor found finished fails the launch too.
+static void linkAnyDeps(LaunchTable& launches, LaunchErrors& errors, Task* task, const std::vector<TaskID>& deps) {
+    std::lock_guard<std::mutex> lock(task -> successors_mutex);
+    task -> wait_any = true;
+    task -> any_armed = true;
+    task -> unfinished_deps ++;
+    bool satisfied = deps.empty();
+    TaskID finished_dep = -1;
+    for (auto dep : deps) {
+        // A finished dependency's record may have been recycled for this
+        // very launch.
+        Task* pred = launches.find(dep);
+        if (pred == nullptr || pred == task) {
+            satisfied = true;
+            finished_dep = dep;
+            break;
+        }
+        std::lock_guard<std::mutex> pred_lock(pred -> successors_mutex);
+        if (pred -> id != dep || pred -> finished) {
+            satisfied = true;
+            finished_dep = dep;
+            break;
+        }
+        pred -> successors.push_back(task);
+        task -> predecessors.push_back(TaskRef{pred, dep});
+    }
+    if (satisfied && task -> any_armed.exchange(false)) {
+        inheritFailure(errors, task, finished_dep);
+        task -> unfinished_deps --;
+    }
+    // A predecessor may also have fired while edges were being added.
+    if (!task -> any_armed) {
+        detachAny(task);
+    }
+}
+
+// Called by a finishing predecessor that cleared any_armed, after it has
+// released its own successors_mutex.  Returns whether the launch is now
+// ready.
+static bool fireAny(Task* task) {
+    {
+        std::lock_guard<std::mutex> lock(task -> successors_mutex);
+        detachAny(task);
+    }
+    return -- task -> unfinished_deps == 0;
+}
+
+/*
+ * ================================================================
+ * Cancellation
+ * ================================================================
+ */
+
+// Flags launch `task_id` as cancelled unless it has already finished.
+// The pools drop the indices of a flagged launch as they claim them, and
+// completeLaunch() passes the flag on to the launch's successors.
+static void cancelLaunch(LaunchTable& launches, TaskID task_id) {
+    Task* task = launches.find(task_id);
+    if (task == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(task -> successors_mutex);
+    if (task -> id == task_id && !task -> finished) {
+        task -> cancelled = true;
+    }
+}
+
+bool isCancelled() {
+    return nested_frame != nullptr && nested_frame -> task -> cancelled;
+}
+
+// Whether indices of `task` claimed now are to be dropped rather than run.
+static bool dropsTasks(Task* task) {
+    return task -> cancelled && !runsWhenCancelled(task);
+}
+
 /*
  * ================================================================
  * Parallel Thread Pool Sleeping Task System Implementation
  * ================================================================
  */
 
+static thread_local TaskSystemParallelThreadPoolSleeping* sleeping_owner = nullptr;
+static thread_local int sleeping_worker_id = -1;
+
+// Pool the calling thread is capturing a graph for, and the task frame it
+// was in when it began.  Tasks the thread runs meanwhile, from sync() or
+// wait(), have frames of their own, so their launches run as usual.
+static thread_local TaskSystemParallelThreadPoolSleeping* capture_owner = nullptr;
+static thread_local NestedFrame* capture_frame = nullptr;
+
 const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads, bool count_caller_as_worker,
+                                                                           PinPolicy pin_policy): ITaskSystem(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
+    if (count_caller_as_worker) {
+        num_threads = std::max(num_threads - 1, 0);
+    }
     this -> num_threads = num_threads;
-    this -> current_task_id = 0;
+    this -> outstanding_launches = 0;
+    this -> ready_sequence = 0;
     this -> task_run_mutex = new std::mutex();
-    this -> finished_task_mutex = new std::mutex();
-    this -> task_run_cr = new std::condition_variable();
-    this -> finished_task_cr = new std::condition_variable();
     this -> killed = false;
+    this -> blocked_threads = 0;
+    this -> running_spares = 0;
+    this -> placement = Topology::system().place(pin_policy, num_threads);
+    for(int i = 0; i < num_threads; i++){
+        this -> slots.push_back(new IdleSlot());
+    }
     for(int i = 0; i < num_threads; i++){
         this -> pool.push_back(std::thread(&TaskSystemParallelThreadPoolSleeping::workThread, this, i));
     }
@@ -152,15 +688,22 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
+    task_run_mutex -> lock();
     killed = true;
-    task_run_cr -> notify_all();
+    for(auto slot : slots) {
+        slot -> cv.notify_one();
+    }
+    task_run_mutex -> unlock();
     for(int i = 0; i < num_threads; i++){
         pool[i].join();
     }
+    for(auto& spare : spares) {
+        spare.join();
+    }
+    for(auto slot : slots) {
+        delete slot;
+    }
     delete task_run_mutex;
-    delete finished_task_mutex;
-    delete task_run_cr;
-    delete finished_task_cr;
 }
 
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
@@ -185,107 +728,1654 @@ TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnabl
     // TODO: CS149 students will implement this method in Part B.
     //
 
-    if (deps.size() == 0) {
-        tasks_dep[current_task_id];
-    }
-    for(auto dep : deps) {
-        tasks_dep[current_task_id].insert(dep);
-    }
-    task_id_to_task[current_task_id] = new Task(current_task_id, runnable, num_total_tasks);
-    return current_task_id++;
+    return runAsyncWithDeps(runnable, num_total_tasks, deps, num_total_tasks);
 }
 
-void TaskSystemParallelThreadPoolSleeping::sync() {
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps, double cost) {
+    return submitLaunch(runnable, num_total_tasks, deps, std::vector<IndexDependency>(), cost, false);
+}
 
-    //
-    // TODO: CS149 students will modify the implementation of this method in Part B.
-    //
-    scanForReadyTasks();
-    
-    bool done_work = false;
-    while(!done_work) {
-        std::unique_lock<std::mutex> finished_task_lock(*finished_task_mutex);
-        while(finished_tasks.empty()){
-            finished_task_cr -> wait(finished_task_lock);
-        }
-        bool has_more_finished_tasks = true;
-        while(has_more_finished_tasks) {
-            auto task_done_id = finished_tasks.front();
-            finished_tasks.pop_front();
-            remaining_tasks.erase(remaining_tasks.find(task_done_id));
-            finished_task_lock.unlock();
-            removeTaskIDFromDependency(task_done_id);
-            finished_task_lock.lock();
-            has_more_finished_tasks = !finished_tasks.empty();
-        }
-        finished_task_lock.unlock();
-
-        scanForReadyTasks();
-
-        finished_task_mutex -> lock();
-        done_work = tasks_dep.empty() && remaining_tasks.empty();
-        finished_task_mutex -> unlock();
-    }
-    return;
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps,
+                                                              const std::vector<IndexDependency>& index_deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, index_deps, num_total_tasks, false);
 }
 
-void TaskSystemParallelThreadPoolSleeping::workThread(int thread_number){
-    while(!killed) {
-        bool done_work = false;
-        while(!done_work) {
-            std::unique_lock<std::mutex> task_run_lock(*task_run_mutex);
-            while(runnable_tasks.empty() && !killed) {
-                task_run_cr -> wait(task_run_lock);
-            }
-            done_work = runnable_tasks.empty();
-            if (done_work) {
-                task_run_lock.unlock();
-                continue;
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, std::vector<IndexDependency>(), num_total_tasks, true);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::submitLaunch(IRunnable* runnable, int num_total_tasks,
+                                                          const std::vector<TaskID>& deps,
+                                                          const std::vector<IndexDependency>& index_deps,
+                                                          double cost, bool wait_any) {
+    if (capture_owner == this && nested_frame == capture_frame) {
+        // Captured graphs only keep whole-launch edges, and wait for all
+        // of them.
+        std::vector<TaskID> all_deps(deps);
+        for (auto& dep : index_deps) {
+            all_deps.push_back(dep.launch);
+        }
+        CapturedLaunch launch;
+        launch.runnable = runnable;
+        launch.num_total_tasks = num_total_tasks;
+        launch.cost = cost;
+        for (auto dep : all_deps) {
+            if (dep >= 0 && dep < TaskID(captured.size())) {
+                launch.deps.push_back(int(dep));
             }
-            auto task = runnable_tasks.front();
-            runnable_tasks.pop_front();
-            task_run_lock.unlock();
+        }
+        captured.push_back(launch);
+        return TaskID(captured.size() - 1);
+    }
+
+    Task* task = launches.allocate(runnable, num_total_tasks);
+    TaskID task_id = task -> id;
+    if (NestedFrame* frame = currentFrame(this)) {
+        frame -> children.push_back(task_id);
+    }
+    task -> cost = cost;
+    task -> bottom_level = cost;
+    outstanding_launches ++;
 
-            task -> runnable -> runTask(task -> current_task_id, task -> num_total_tasks);
+    // Workers retire launches concurrently with this loop.  Hold one extra
+    // count so the launch cannot be released before all edges are added.
+    task -> unfinished_deps = 1;
+    if (wait_any) {
+        linkAnyDeps(launches, errors, task, deps);
+    } else {
+        for(auto dep : deps) {
+            Task* pred = launches.find(dep);
+            if (pred == nullptr) {
+                continue;
+            }
+            // A record recycled since the lookup carries a newer id.
+            std::lock_guard<std::mutex> lock(pred -> successors_mutex);
+            if (pred -> id == dep && !pred -> finished) {
+                pred -> successors.push_back(task);
+                task -> predecessors.push_back(TaskRef{pred, dep});
+                task -> unfinished_deps ++;
+            } else {
+                inheritFailure(errors, task, dep);
+            }
+        }
+    }
 
-            finished_task_mutex -> lock();
-            remaining_tasks[task -> id] --;
-            if (remaining_tasks[task -> id] <= 0){
-                finished_tasks.push_back(task -> id);
-                finished_task_mutex -> unlock();
-                finished_task_cr -> notify_one();
+    if (!index_deps.empty()) {
+        task -> index_scheduled = true;
+        task -> index_waits.assign(std::max(num_total_tasks, 0), 0);
+        // Predecessor tasks finish under task_run_mutex, so holding it
+        // keeps each predecessor from starting while its edge is added.
+        std::lock_guard<std::mutex> task_run_lock(*task_run_mutex);
+        for (auto& dep : index_deps) {
+            Task* pred = launches.find(dep.launch);
+            if (pred == nullptr) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(pred -> successors_mutex);
+            if (pred -> id != dep.launch || pred -> finished) {
+                inheritFailure(errors, task, dep.launch);
+                continue;
+            }
+            if (!addIndexDependency(task, pred, dep)) {
+                pred -> successors.push_back(task);
+                task -> unfinished_deps ++;
             }
-            else {
-                finished_task_mutex -> unlock();
+            task -> predecessors.push_back(TaskRef{pred, dep.launch});
+        }
+        for (int i = num_total_tasks - 1; i >= 0; i--) {
+            if (task -> index_waits[i] == 0) {
+                task -> ready_indices.push_back(i);
+            }
+        }
+    }
+
+    for (TaskRef pred : task -> predecessors) {
+        raiseBottomLevel(pred, cost, PRIORITY_PROPAGATION_DEPTH);
+    }
+    if (-- task -> unfinished_deps == 0) {
+        enqueueLaunch(task);
+    }
+    return task_id;
+}
+
+// Makes the tasks of `task` wait on just the tasks of `pred` named by
+// `dep`.  Fails when some task of `pred` may already have run, or `pred`
+// is a graph node; the caller then waits for all of `pred` instead.
+// Called with task_run_mutex and pred's successors_mutex held.
+bool TaskSystemParallelThreadPoolSleeping::addIndexDependency(Task* task, Task* pred, const IndexDependency& dep) {
+    if (pred -> next_index > 0 || pred -> graph != nullptr) {
+        return false;
+    }
+
+    IndexEdge* edge = new IndexEdge();
+    edge -> successor = task;
+    edge -> successor_tasks = task -> num_total_tasks;
+    edge -> kind = dep.kind;
+    edge -> radius = dep.kind == INDEX_STENCIL ? std::max(dep.radius, 0) : 0;
+
+    int pred_tasks = pred -> num_total_tasks;
+    if (dep.kind == INDEX_MAP) {
+        edge -> inverse_map.resize(std::max(pred_tasks, 0));
+        for (int i = 0; i < task -> num_total_tasks && i < int(dep.index_map.size()); i++) {
+            int j = dep.index_map[i];
+            if (j >= 0 && j < pred_tasks) {
+                edge -> inverse_map[j].push_back(i);
+                task -> index_waits[i] ++;
             }
         }
+    } else {
+        for (int i = 0; i < task -> num_total_tasks; i++) {
+            int first = std::max(i - edge -> radius, 0);
+            int last = std::min(i + edge -> radius, pred_tasks - 1);
+            task -> index_waits[i] += std::max(last - first + 1, 0);
+        }
     }
+    pred -> index_successors.push_back(edge);
+    return true;
 }
 
-void TaskSystemParallelThreadPoolSleeping::scanForReadyTasks(){
-    for (auto it = tasks_dep.begin(); it != tasks_dep.end();) {
-        auto tasks = it -> second;
-        if(tasks.empty()){
-            Task* t = task_id_to_task[it -> first];
-            remaining_tasks[t -> id] = t -> num_total_tasks;
+// Counts task `index` of `task` as finished for the tasks that depend on
+// it, queueing those that have nothing left to wait for.  If `task` was
+// cancelled, so are those dependent launches; they still count the index
+// off, so that their dropped tasks retire.  Called with task_run_mutex
+// held.
+void TaskSystemParallelThreadPoolSleeping::finishIndex(Task* task, int index, LaunchError* error,
+                                                       bool cancelled) {
+    for (IndexEdge* edge : task -> index_successors) {
+        Task* successor = edge -> successor;
+        int newly_ready = 0;
+        // A successor none of whose tasks need this index may already be
+        // gone, so only those still waiting on it are touched.
+        if (edge -> kind == INDEX_MAP) {
+            for (int i : edge -> inverse_map[index]) {
+                if (cancelled) {
+                    cancelSuccessor(successor, error);
+                }
+                if (-- successor -> index_waits[i] == 0) {
+                    successor -> ready_indices.push_back(i);
+                    newly_ready ++;
+                }
+            }
+        } else {
+            int first = std::max(index - edge -> radius, 0);
+            int last = std::min(index + edge -> radius, edge -> successor_tasks - 1);
+            for (int i = first; i <= last; i++) {
+                if (cancelled) {
+                    cancelSuccessor(successor, error);
+                }
+                if (-- successor -> index_waits[i] == 0) {
+                    successor -> ready_indices.push_back(i);
+                    newly_ready ++;
+                }
+            }
+        }
+        if (newly_ready > 0 && successor -> launch_ready) {
+            if (!successor -> queued) {
+                pushReady(successor);
+            }
+            wakeIdleThreads(newly_ready);
+        }
+    }
+}
 
-            task_run_mutex -> lock();
-            for(int i = 0; i < t -> num_total_tasks; i++){
-                runnable_tasks.push_back(new RunnableTask(t -> id, i, t -> runnable, t -> num_total_tasks));
+// Lifts the bottom level of `pred` to cover a successor with bottom level
+// `successor_level`, and carries the increase on to its own predecessors
+// for up to `depth` more levels.  Finished launches need no priority.
+void TaskSystemParallelThreadPoolSleeping::raiseBottomLevel(TaskRef pred, double successor_level, int depth) {
+    SmallVector<TaskRef, TASK_INLINE_SUCCESSORS> next;
+    double level;
+    {
+        std::lock_guard<std::mutex> lock(pred.task -> successors_mutex);
+        if (pred.task -> id != pred.id || pred.task -> finished) {
+            return;
+        }
+        level = pred.task -> cost + successor_level;
+        if (level <= pred.task -> bottom_level) {
+            return;
+        }
+        pred.task -> bottom_level = level;
+        if (depth > 0) {
+            for (TaskRef ref : pred.task -> predecessors) {
+                next.push_back(ref);
             }
-            task_run_mutex -> unlock();
+        }
+    }
+    for (TaskRef ref : next) {
+        raiseBottomLevel(ref, level, depth - 1);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::sync() {
+
+    //
+    // TODO: CS149 students will modify the implementation of this method in Part B.
+    //
 
-            task_run_cr -> notify_all();
-            it = tasks_dep.erase(it);
+    // From inside a task, only the launches that task submitted.
+    if (NestedFrame* frame = currentFrame(this)) {
+        std::vector<TaskID> children;
+        children.swap(frame -> children);
+        wait(children);
+        return;
+    }
+
+    // Help the pool with ready work until every launch has finished.
+    std::unique_lock<std::mutex> task_run_lock(*task_run_mutex);
+    int slot = acquireCallerSlot();
+    while(outstanding_launches > 0) {
+        if (runnable_tasks.empty()) {
+            waitForWork(slot, task_run_lock);
+            continue;
+        }
+        runNextTask(task_run_lock);
+    }
+    releaseCallerSlot(slot);
+    task_run_lock.unlock();
+    errors.rethrowUnreported();
+}
+
+void TaskSystemParallelThreadPoolSleeping::wait(TaskID task_id) {
+    wait(std::vector<TaskID>{task_id});
+}
+
+// Like sync(), but only until the given launches are done.  The calling
+// thread runs whatever work is ready in the meantime, whether or not the
+// launches it waits for depend on it.  A pool thread waiting from inside
+// a task sleeps on its own slot, where new work can wake it too.
+void TaskSystemParallelThreadPoolSleeping::wait(const std::vector<TaskID>& task_ids) {
+    std::vector<TaskID> pending;
+    for (auto task_id : task_ids) {
+        Task* task = launches.find(task_id);
+        if (task == nullptr) {
+            continue;
         }
-        else { 
-            ++it;
+        std::lock_guard<std::mutex> lock(task -> successors_mutex);
+        if (task -> id == task_id && !task -> finished) {
+            task -> has_waiter = true;
+            pending.push_back(task_id);
         }
     }
+
+    bool outside = sleeping_owner != this;
+    std::unique_lock<std::mutex> task_run_lock(*task_run_mutex);
+    int slot = outside ? acquireCallerSlot() : sleeping_worker_id;
+    bool outer_waiting = slots[slot] -> waiting;
+    slots[slot] -> waiting = true;
+    while (!pending.empty()) {
+        if (isDone(pending.back())) {
+            pending.pop_back();
+            continue;
+        }
+        if (runnable_tasks.empty()) {
+            waitForWork(slot, task_run_lock);
+            continue;
+        }
+        runNextTask(task_run_lock);
+    }
+    slots[slot] -> waiting = outer_waiting;
+    if (outside) {
+        releaseCallerSlot(slot);
+    }
+    task_run_lock.unlock();
+    errors.rethrowFor(task_ids);
 }
 
-void TaskSystemParallelThreadPoolSleeping::removeTaskIDFromDependency(TaskID finished_task) {
-    for (auto it = tasks_dep.begin(); it != tasks_dep.end(); it++) {
-        it -> second.erase(finished_task);
+bool TaskSystemParallelThreadPoolSleeping::isDone(TaskID task_id) {
+    Task* task = launches.find(task_id);
+    if (task == nullptr) {
+        return true;
     }
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(task -> successors_mutex);
+    return task -> id != task_id || task -> finished;
+}
+
+void TaskSystemParallelThreadPoolSleeping::cancel(TaskID task_id) {
+    cancelLaunch(launches, task_id);
+}
+
+void TaskSystemParallelThreadPoolSleeping::beginCapture() {
+    capture_owner = this;
+    capture_frame = nested_frame;
+    captured.clear();
+}
+
+TaskGraph* TaskSystemParallelThreadPoolSleeping::endCapture() {
+    TaskGraph* graph = new TaskGraph(captured);
+    capture_owner = nullptr;
+    capture_frame = nullptr;
+    captured.clear();
+    return graph;
+}
+
+void TaskSystemParallelThreadPoolSleeping::launchGraph(TaskGraph* graph) {
+    if (graph -> running_nodes > 0) {
+        sync();
+    }
+
+    for (int i = 0; i < graph -> num_nodes; i++) {
+        Task* node = &graph -> nodes[i];
+        node -> finished = false;
+        node -> cancelled = false;
+        node -> error = nullptr;
+        node -> next_index = 0;
+        node -> remaining = node -> num_total_tasks;
+        node -> unfinished_deps = graph -> in_degrees[i];
+    }
+    graph -> running_nodes = graph -> num_nodes;
+    outstanding_launches += graph -> num_nodes;
+
+    for (int root : graph -> roots) {
+        enqueueLaunch(&graph -> nodes[root]);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::workThread(int thread_number){
+    pinCurrentThread(placement[thread_number].cpus);
+    sleeping_owner = this;
+    sleeping_worker_id = thread_number;
+    std::unique_lock<std::mutex> task_run_lock(*task_run_mutex);
+    while(!killed) {
+        if (runnable_tasks.empty()) {
+            waitForWork(thread_number, task_run_lock);
+            continue;
+        }
+        runNextTask(task_run_lock);
+    }
+}
+
+// Spare threads run ready work like the pool threads while there are
+// fewer of them than blocked tasks, and park on their slot otherwise.
+void TaskSystemParallelThreadPoolSleeping::spareThread(int slot){
+    sleeping_owner = this;
+    sleeping_worker_id = slot;
+    std::unique_lock<std::mutex> task_run_lock(*task_run_mutex);
+    while(!killed) {
+        if (running_spares > blocked_threads) {
+            running_spares --;
+            parked_spares.push_back(slot);
+            // Pass on a wakeup this thread may have been given for new work.
+            if (!runnable_tasks.empty()) {
+                wakeIdleThreads(1);
+            }
+            IdleSlot* idle = slots[slot];
+            idle -> woken = false;
+            while (!idle -> woken && !killed) {
+                idle -> cv.wait(task_run_lock);
+            }
+            continue;
+        }
+        if (runnable_tasks.empty()) {
+            waitForWork(slot, task_run_lock);
+            continue;
+        }
+        runNextTask(task_run_lock);
+    }
+}
+
+// Brings a spare thread into service when there are fewer running spares
+// than blocked tasks, reusing a parked one if possible.  At most
+// num_threads spares are ever started.
+void TaskSystemParallelThreadPoolSleeping::beginBlocking(){
+    std::lock_guard<std::mutex> lock(*task_run_mutex);
+    blocked_threads ++;
+    if (running_spares >= blocked_threads) {
+        return;
+    }
+    if (!parked_spares.empty()) {
+        int slot = parked_spares.back();
+        parked_spares.pop_back();
+        running_spares ++;
+        slots[slot] -> woken = true;
+        slots[slot] -> cv.notify_one();
+    } else if (int(spares.size()) < std::max(num_threads, 1)) {
+        int slot = int(slots.size());
+        slots.push_back(new IdleSlot());
+        running_spares ++;
+        spares.push_back(std::thread(&TaskSystemParallelThreadPoolSleeping::spareThread, this, slot));
+    }
+}
+
+// The surplus spare parks itself once it is done with its current task.
+void TaskSystemParallelThreadPoolSleeping::endBlocking(){
+    std::lock_guard<std::mutex> lock(*task_run_mutex);
+    blocked_threads --;
+}
+
+// Heap order of the ready queue: highest bottom level on top, oldest
+// first among equals.
+static bool readyBefore(const Task* a, const Task* b) {
+    if (a -> ready_priority != b -> ready_priority) {
+        return a -> ready_priority < b -> ready_priority;
+    }
+    return a -> ready_order > b -> ready_order;
+}
+
+// Claims one index of the launch at the top of the ready queue and runs
+// it.  Called with task_run_lock held; the lock is dropped while the task
+// runs and held again on return.
+void TaskSystemParallelThreadPoolSleeping::runNextTask(std::unique_lock<std::mutex>& task_run_lock){
+    auto task = runnable_tasks.front();
+    int index;
+    int count = 1;
+    bool exhausted;
+    bool cancelled = dropsTasks(task);
+    if (task -> index_scheduled) {
+        index = task -> ready_indices.back();
+        task -> ready_indices.pop_back();
+        task -> next_index ++;
+        exhausted = task -> ready_indices.empty();
+    } else {
+        index = task -> next_index ++;
+        // A cancelled launch gives up all its unclaimed indices at once.
+        if (cancelled) {
+            count = task -> num_total_tasks - index;
+            task -> next_index = task -> num_total_tasks;
+        }
+        exhausted = index + count >= task -> num_total_tasks;
+    }
+    if (exhausted) {
+        std::pop_heap(runnable_tasks.begin(), runnable_tasks.end(), readyBefore);
+        runnable_tasks.pop_back();
+        task -> queued = false;
+    }
+    // Pass on what this thread cannot take itself.
+    if (!runnable_tasks.empty()) {
+        wakeIdleThreads(1);
+    }
+    task_run_lock.unlock();
+
+    if (!cancelled) {
+        runTaskInFrame(this, task, index);
+    }
+
+    // Edges are only added before the first task of a launch is claimed.
+    // Every dropped index counts as finished too, so that the tasks
+    // depending on it are dropped in turn rather than left waiting.
+    if (!task -> index_successors.empty()) {
+        // A task that threw has cancelled the launch since it was claimed.
+        cancelled = task -> cancelled;
+        LaunchError* error = task -> error;
+        task_run_lock.lock();
+        for (int i = index; i < index + count; i++) {
+            finishIndex(task, i, error, cancelled);
+        }
+        task_run_lock.unlock();
+    }
+    if (task -> remaining.fetch_sub(count) == count) {
+        completeLaunch(task);
+    }
+    task_run_lock.lock();
+}
+
+void TaskSystemParallelThreadPoolSleeping::enqueueLaunch(Task* task){
+    if (task -> num_total_tasks <= 0) {
+        // Nothing will ever run for an empty launch, so retire it here.
+        completeLaunch(task);
+        return;
+    }
+
+    task_run_mutex -> lock();
+    task -> launch_ready = true;
+    if (!task -> index_scheduled) {
+        pushReady(task);
+        wakeIdleThreads(task -> num_total_tasks);
+    } else if (!task -> ready_indices.empty()) {
+        pushReady(task);
+        wakeIdleThreads(int(task -> ready_indices.size()));
+    }
+    task_run_mutex -> unlock();
+}
+
+// Adds `task` to the ready heap.  Called with task_run_mutex held.
+void TaskSystemParallelThreadPoolSleeping::pushReady(Task* task){
+    task -> ready_priority = task -> bottom_level;
+    task -> ready_order = ready_sequence++;
+    task -> queued = true;
+    runnable_tasks.push_back(task);
+    std::push_heap(runnable_tasks.begin(), runnable_tasks.end(), readyBefore);
+}
+
+// Sleeps on the thread's own slot until another thread wakes it or the
+// pool shuts down.  Called with task_run_lock held; callers re-check what
+// they are waiting for on return.
+void TaskSystemParallelThreadPoolSleeping::waitForWork(int slot, std::unique_lock<std::mutex>& task_run_lock){
+    IdleSlot* idle = slots[slot];
+    idle -> woken = false;
+    idle_slots.push_back(slot);
+    while (!idle -> woken && !killed) {
+        idle -> cv.wait(task_run_lock);
+    }
+    if (!idle -> woken) {
+        idle_slots.erase(std::find(idle_slots.begin(), idle_slots.end(), slot));
+    }
+}
+
+// Wakes up to `count` idle threads, most recently idle first since their
+// caches are the warmest.  Called with task_run_mutex held.
+void TaskSystemParallelThreadPoolSleeping::wakeIdleThreads(int count){
+    while (count > 0 && !idle_slots.empty()) {
+        IdleSlot* idle = slots[idle_slots.back()];
+        idle_slots.pop_back();
+        idle -> woken = true;
+        idle -> cv.notify_one();
+        count--;
+    }
+}
+
+// Wakes the thread owning `slot` if it is idle.  Called with
+// task_run_mutex held.
+void TaskSystemParallelThreadPoolSleeping::wakeSlot(int slot){
+    auto it = std::find(idle_slots.begin(), idle_slots.end(), slot);
+    if (it == idle_slots.end()) {
+        return;
+    }
+    idle_slots.erase(it);
+    slots[slot] -> woken = true;
+    slots[slot] -> cv.notify_one();
+}
+
+// Gives a thread calling sync() or wait() from outside the pool a slot of
+// its own, so that every such thread can be woken.  Called with
+// task_run_mutex held.
+int TaskSystemParallelThreadPoolSleeping::acquireCallerSlot(){
+    int slot;
+    if (free_caller_slots.empty()) {
+        slot = int(slots.size());
+        slots.push_back(new IdleSlot());
+    } else {
+        slot = free_caller_slots.back();
+        free_caller_slots.pop_back();
+    }
+    caller_slots.push_back(slot);
+    return slot;
+}
+
+void TaskSystemParallelThreadPoolSleeping::releaseCallerSlot(int slot){
+    caller_slots.erase(std::find(caller_slots.begin(), caller_slots.end(), slot));
+    free_caller_slots.push_back(slot);
+}
+
+void TaskSystemParallelThreadPoolSleeping::completeLaunch(Task* task) {
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> ready;
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> fired;
+    TaskGraph* graph = task -> graph;
+    LaunchError* error = task -> error;
+    if (error != nullptr) {
+        errors.recordFailure(task -> id, error);
+    }
+    task -> successors_mutex.lock();
+    task -> finished = true;
+    bool has_waiter = task -> has_waiter;
+    bool cancelled = task -> cancelled;
+    for (Task* successor : task -> successors) {
+        if (successor -> wait_any) {
+            // Only the predecessor that fires an any-of launch decides
+            // whether it is cancelled or failed.
+            if (successor -> any_armed.exchange(false)) {
+                if (cancelled) {
+                    cancelSuccessor(successor, error);
+                }
+                fired.push_back(successor);
+            }
+            continue;
+        }
+        if (cancelled) {
+            cancelSuccessor(successor, error);
+        }
+        if (-- successor -> unfinished_deps == 0) {
+            ready.push_back(successor);
+        }
+    }
+    // Graph nodes keep their edges for the next launch of the graph.
+    if (graph == nullptr) {
+        task -> successors.clear();
+    }
+    task -> successors_mutex.unlock();
+    releaseFailure(task);
+
+    for (Task* successor : fired) {
+        if (fireAny(successor)) {
+            ready.push_back(successor);
+        }
+    }
+    for (Task* successor : ready) {
+        enqueueLaunch(successor);
+    }
+
+    // Every index has been counted off, so no index successor still
+    // waits on this launch.
+    for (IndexEdge* edge : task -> index_successors) {
+        delete edge;
+    }
+    task -> index_successors.clear();
+
+    if (graph == nullptr) {
+        launches.release(task);
+    } else {
+        graph -> running_nodes --;
+    }
+
+    // Successors were counted when submitted, so the counter can only reach
+    // zero once the whole graph has drained.
+    if (-- outstanding_launches == 0 || has_waiter) {
+        task_run_mutex -> lock();
+        for (int slot : caller_slots) {
+            wakeSlot(slot);
+        }
+        if (has_waiter) {
+            for (int i = 0; i < int(slots.size()); i++) {
+                if (slots[i] -> waiting) {
+                    wakeSlot(i);
+                }
+            }
+        }
+        task_run_mutex -> unlock();
+    }
+}
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Work-Stealing Task System Implementation
+ * ================================================================
+ */
+
+// Identifies the pool (and the slot within it) that the current thread
+// works for, so launches released by a worker go onto its own deque.
+static thread_local TaskSystemParallelThreadPoolStealing* stealing_owner = nullptr;
+static thread_local int stealing_worker_id = -1;
+
+// Failed steal rounds before an idle worker goes to sleep.
+static const int STEAL_ROUNDS_BEFORE_SLEEP = 64;
+
+const char* TaskSystemParallelThreadPoolStealing::name() {
+    return "Parallel + Thread Pool + Steal";
+}
+
+TaskSystemParallelThreadPoolStealing::TaskSystemParallelThreadPoolStealing(int num_threads, PinPolicy pin_policy): ITaskSystem(num_threads) {
+    this -> num_threads = num_threads;
+    this -> killed = false;
+    this -> outstanding_launches = 0;
+    this -> num_sleeping = 0;
+    this -> max_spares = std::max(num_threads, 1);
+    this -> blocked_threads = 0;
+    this -> running_spares = 0;
+    this -> placement = Topology::system().place(pin_policy, num_threads);
+    this -> num_nodes = 1;
+    for(int i = 0; i < num_threads; i++){
+        this -> num_nodes = std::max(this -> num_nodes, placement[i].node + 1);
+    }
+    // Spare threads are not pinned and are spread over the nodes.
+    for(int i = 0; i < max_spares; i++){
+        WorkerPlacement spare;
+        spare.node = i % num_nodes;
+        this -> placement.push_back(spare);
+        this -> spare_wanted.push_back(0);
+    }
+    this -> node_workers.resize(num_nodes);
+    for(int i = 0; i < num_threads + max_spares; i++){
+        this -> node_workers[placement[i].node].push_back(i);
+    }
+    for(int i = 0; i < num_nodes; i++){
+        this -> injected.push_back(new NodeQueue());
+    }
+    this -> idle_mutex = new std::mutex();
+    this -> sync_mutex = new std::mutex();
+    this -> spare_mutex = new std::mutex();
+    this -> idle_cr = new std::condition_variable();
+    this -> sync_cr = new std::condition_variable();
+    this -> spare_cr = new std::condition_variable();
+    for(int i = 0; i < num_threads + max_spares; i++){
+        this -> deques.push_back(new WorkStealingDeque<TaskRange>());
+    }
+    for(int i = 0; i < num_threads; i++){
+        this -> pool.push_back(std::thread(&TaskSystemParallelThreadPoolStealing::workThread, this, i));
+    }
+}
+
+TaskSystemParallelThreadPoolStealing::~TaskSystemParallelThreadPoolStealing() {
+    // An exception nobody has synced for is dropped with the pool.
+    try {
+        sync();
+    } catch (...) {
+    }
+    idle_mutex -> lock();
+    killed = true;
+    idle_mutex -> unlock();
+    idle_cr -> notify_all();
+    spare_mutex -> lock();
+    spare_mutex -> unlock();
+    spare_cr -> notify_all();
+    for(int i = 0; i < num_threads; i++){
+        pool[i].join();
+    }
+    for(auto& spare : spares) {
+        spare.join();
+    }
+    for(auto deque : deques) {
+        delete deque;
+    }
+    for(int i = 0; i < num_nodes; i++){
+        delete injected[i];
+    }
+    delete idle_mutex;
+    delete sync_mutex;
+    delete spare_mutex;
+    delete idle_cr;
+    delete sync_cr;
+    delete spare_cr;
+}
+
+void TaskSystemParallelThreadPoolStealing::run(IRunnable* runnable, int num_total_tasks) {
+    runAsyncWithDeps(runnable, num_total_tasks, {});
+    sync();
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, false);
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, true);
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::submitLaunch(IRunnable* runnable, int num_total_tasks,
+                                                          const std::vector<TaskID>& deps, bool wait_any) {
+    Task* task = launches.allocate(runnable, num_total_tasks);
+    TaskID task_id = task -> id;
+    if (NestedFrame* frame = currentFrame(this)) {
+        frame -> children.push_back(task_id);
+    }
+    outstanding_launches ++;
+
+    // Hold one extra count so the launch cannot be released by a
+    // predecessor finishing while its edges are still being added.
+    task -> unfinished_deps = 1;
+    if (wait_any) {
+        linkAnyDeps(launches, errors, task, deps);
+    } else {
+        for(auto dep : deps) {
+            Task* pred = launches.find(dep);
+            if (pred == nullptr) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(pred -> successors_mutex);
+            if (pred -> id == dep && !pred -> finished) {
+                pred -> successors.push_back(task);
+                task -> unfinished_deps ++;
+            } else {
+                inheritFailure(errors, task, dep);
+            }
+        }
+    }
+    if (-- task -> unfinished_deps == 0) {
+        scheduleLaunch(task);
+    }
+    return task_id;
+}
+
+void TaskSystemParallelThreadPoolStealing::sync() {
+    // From inside a task, only the launches that task submitted.
+    if (NestedFrame* frame = currentFrame(this)) {
+        std::vector<TaskID> children;
+        children.swap(frame -> children);
+        wait(children);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(*sync_mutex);
+    while (outstanding_launches > 0) {
+        sync_cr -> wait(lock);
+    }
+    lock.unlock();
+    errors.rethrowUnreported();
+}
+
+void TaskSystemParallelThreadPoolStealing::wait(TaskID task_id) {
+    wait(std::vector<TaskID>{task_id});
+}
+
+// Waits until the given launches are done.  A pool thread keeps taking
+// work from its own deque and from other workers in the meantime, so
+// nested launches cannot deadlock the pool; other threads sleep.
+void TaskSystemParallelThreadPoolStealing::wait(const std::vector<TaskID>& task_ids) {
+    std::vector<TaskID> pending;
+    for (auto task_id : task_ids) {
+        Task* task = launches.find(task_id);
+        if (task == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(task -> successors_mutex);
+        if (task -> id == task_id && !task -> finished) {
+            task -> has_waiter = true;
+            pending.push_back(task_id);
+        }
+    }
+
+    if (stealing_owner == this) {
+        int thread_number = stealing_worker_id;
+        unsigned int seed = thread_number * 2654435761u + 7;
+        while (!pending.empty()) {
+            if (isDone(pending.back())) {
+                pending.pop_back();
+                continue;
+            }
+            TaskRange* range = findWork(thread_number, &seed);
+            if (range) {
+                executeRange(thread_number, range);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        errors.rethrowFor(task_ids);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(*sync_mutex);
+    while (!pending.empty()) {
+        if (isDone(pending.back())) {
+            pending.pop_back();
+            continue;
+        }
+        sync_cr -> wait(lock);
+    }
+    lock.unlock();
+    errors.rethrowFor(task_ids);
+}
+
+bool TaskSystemParallelThreadPoolStealing::isDone(TaskID task_id) {
+    Task* task = launches.find(task_id);
+    if (task == nullptr) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(task -> successors_mutex);
+    return task -> id != task_id || task -> finished;
+}
+
+void TaskSystemParallelThreadPoolStealing::cancel(TaskID task_id) {
+    cancelLaunch(launches, task_id);
+}
+
+void TaskSystemParallelThreadPoolStealing::workThread(int thread_number) {
+    pinCurrentThread(placement[thread_number].cpus);
+    stealing_owner = this;
+    stealing_worker_id = thread_number;
+    unsigned int seed = thread_number * 2654435761u + 1;
+
+    while (!killed) {
+        if (thread_number >= num_threads && running_spares > blocked_threads) {
+            parkSpare(thread_number);
+            continue;
+        }
+
+        TaskRange* range = nullptr;
+        for (int round = 0; round < STEAL_ROUNDS_BEFORE_SLEEP && !range && !killed; round++) {
+            range = findWork(thread_number, &seed);
+            if (!range) {
+                std::this_thread::yield();
+            }
+        }
+        if (range) {
+            executeRange(thread_number, range);
+            continue;
+        }
+
+        // Advertise that we are about to sleep before the final check for
+        // work, pairing with the fence in pushRange().
+        std::unique_lock<std::mutex> lock(*idle_mutex);
+        num_sleeping ++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!killed && !hasQueuedWork()) {
+            idle_cr -> wait(lock);
+        }
+        num_sleeping --;
+    }
+}
+
+// Takes a spare thread out of service until beginBlocking() wants it
+// again.  Whatever is left on its deque is stolen by the others.
+void TaskSystemParallelThreadPoolStealing::parkSpare(int thread_number) {
+    int spare = thread_number - num_threads;
+    std::unique_lock<std::mutex> lock(*spare_mutex);
+    if (running_spares <= blocked_threads) {
+        return;
+    }
+    running_spares --;
+    parked_spares.push_back(spare);
+    spare_wanted[spare] = 0;
+    lock.unlock();
+
+    // Pass on a wakeup this thread may have been given for new work.
+    if (hasQueuedWork() && num_sleeping > 0) {
+        idle_mutex -> lock();
+        idle_mutex -> unlock();
+        idle_cr -> notify_one();
+    }
+
+    lock.lock();
+    while (!spare_wanted[spare] && !killed) {
+        spare_cr -> wait(lock);
+    }
+}
+
+// Brings a spare thread into service when there are fewer running spares
+// than blocked tasks, reusing a parked one if possible.
+void TaskSystemParallelThreadPoolStealing::beginBlocking() {
+    std::lock_guard<std::mutex> lock(*spare_mutex);
+    blocked_threads ++;
+    if (running_spares >= blocked_threads) {
+        return;
+    }
+    if (!parked_spares.empty()) {
+        int spare = parked_spares.back();
+        parked_spares.pop_back();
+        spare_wanted[spare] = 1;
+        running_spares ++;
+        spare_cr -> notify_all();
+    } else if (int(spares.size()) < max_spares) {
+        int thread_number = num_threads + int(spares.size());
+        running_spares ++;
+        spares.push_back(std::thread(&TaskSystemParallelThreadPoolStealing::workThread, this, thread_number));
+    }
+}
+
+// The surplus spare parks itself once it is done with its current range.
+void TaskSystemParallelThreadPoolStealing::endBlocking() {
+    std::lock_guard<std::mutex> lock(*spare_mutex);
+    blocked_threads --;
+}
+
+TaskRange* TaskSystemParallelThreadPoolStealing::findWork(int thread_number, unsigned int* seed) {
+    TaskRange* range = deques[thread_number] -> pop();
+    if (range) {
+        return range;
+    }
+
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    // Own node first, then the others: the node's injection queue, then one
+    // pass over its workers starting from a random victim.
+    int home = placement[thread_number].node;
+    for (int n = 0; n < num_nodes; n++) {
+        int node = (home + n) % num_nodes;
+        range = takeInjected(node);
+        if (range) {
+            return range;
+        }
+
+        const std::vector<int>& workers = node_workers[node];
+        if (workers.empty()) {
+            continue;
+        }
+        int start = *seed % workers.size();
+        for (size_t i = 0; i < workers.size(); i++) {
+            int victim = workers[(start + i) % workers.size()];
+            if (victim == thread_number) {
+                continue;
+            }
+            range = deques[victim] -> steal();
+            if (range) {
+                return range;
+            }
+        }
+    }
+    return nullptr;
+}
+
+TaskRange* TaskSystemParallelThreadPoolStealing::takeInjected(int node) {
+    NodeQueue* queue = injected[node];
+    if (queue -> size == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(queue -> mutex);
+    if (queue -> ranges.empty()) {
+        return nullptr;
+    }
+    TaskRange* range = queue -> ranges.front();
+    queue -> ranges.pop_front();
+    queue -> size --;
+    return range;
+}
+
+// Injection queue for a range submitted from outside the pool: the
+// submitting thread's node if the pool has workers there.
+int TaskSystemParallelThreadPoolStealing::submitNode() {
+    if (num_nodes == 1) {
+        return 0;
+    }
+    int node = currentNode();
+    return node < num_nodes && !node_workers[node].empty() ? node : 0;
+}
+
+void TaskSystemParallelThreadPoolStealing::executeRange(int thread_number, TaskRange* range) {
+    Task* task = range -> task;
+    int total = task -> num_total_tasks;
+    int grain = std::max(1, total / (num_threads * 8));
+
+    // Split off the upper half until the range is small enough to run, so
+    // that idle workers have something to steal.  A cancelled launch's
+    // range is dropped whole.
+    while (range -> end - range -> begin > grain && !dropsTasks(task)) {
+        int mid = range -> begin + (range -> end - range -> begin) / 2;
+        pushRange(new TaskRange(task, mid, range -> end));
+        range -> end = mid;
+    }
+
+    int count = range -> end - range -> begin;
+    for (int i = range -> begin; i < range -> end && !dropsTasks(task); i++) {
+        runTaskInFrame(this, task, i);
+    }
+    delete range;
+
+    if (task -> remaining.fetch_sub(count) == count) {
+        completeLaunch(task);
+    }
+}
+
+void TaskSystemParallelThreadPoolStealing::scheduleLaunch(Task* task) {
+    if (task -> num_total_tasks <= 0) {
+        completeLaunch(task);
+        return;
+    }
+    pushRange(new TaskRange(task, 0, task -> num_total_tasks));
+}
+
+void TaskSystemParallelThreadPoolStealing::completeLaunch(Task* task) {
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> ready;
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> fired;
+    LaunchError* error = task -> error;
+    if (error != nullptr) {
+        errors.recordFailure(task -> id, error);
+    }
+    task -> successors_mutex.lock();
+    task -> finished = true;
+    bool has_waiter = task -> has_waiter;
+    bool cancelled = task -> cancelled;
+    for (Task* successor : task -> successors) {
+        if (successor -> wait_any) {
+            // Only the predecessor that fires an any-of launch decides
+            // whether it is cancelled or failed.
+            if (successor -> any_armed.exchange(false)) {
+                if (cancelled) {
+                    cancelSuccessor(successor, error);
+                }
+                fired.push_back(successor);
+            }
+            continue;
+        }
+        if (cancelled) {
+            cancelSuccessor(successor, error);
+        }
+        if (-- successor -> unfinished_deps == 0) {
+            ready.push_back(successor);
+        }
+    }
+    task -> successors.clear();
+    task -> successors_mutex.unlock();
+    releaseFailure(task);
+
+    for (Task* successor : fired) {
+        if (fireAny(successor)) {
+            ready.push_back(successor);
+        }
+    }
+    for (Task* successor : ready) {
+        scheduleLaunch(successor);
+    }
+
+    launches.release(task);
+
+    if (-- outstanding_launches == 0 || has_waiter) {
+        sync_mutex -> lock();
+        sync_mutex -> unlock();
+        sync_cr -> notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolStealing::pushRange(TaskRange* range) {
+    if (stealing_owner == this) {
+        deques[stealing_worker_id] -> push(range);
+    } else {
+        NodeQueue* queue = injected[submitNode()];
+        std::lock_guard<std::mutex> lock(queue -> mutex);
+        queue -> ranges.push_back(range);
+        queue -> size ++;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_sleeping > 0) {
+        idle_mutex -> lock();
+        idle_mutex -> unlock();
+        idle_cr -> notify_one();
+    }
+}
+
+bool TaskSystemParallelThreadPoolStealing::hasQueuedWork() {
+    for (int i = 0; i < num_nodes; i++) {
+        if (injected[i] -> size > 0) {
+            return true;
+        }
+    }
+    for (auto deque : deques) {
+        if (!deque -> empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Fiber Task System Implementation
+ * ================================================================
+ */
+
+// The fiber the current thread is running, if any.  Set and cleared by
+// the pool thread around each switch into a fiber.
+static thread_local Fiber* current_fiber = nullptr;
+
+// Sleeps shorter than this are waited out by yielding rather than by a
+// timed wait on the condition variable, whose wakeup is much coarser.
+static const std::chrono::microseconds FIBER_SPIN_WINDOW(100);
+
+// Code running on a fiber may resume on another thread, and the compiler
+// is free to keep the address of a thread_local across a call.  Fiber
+// code therefore goes through these out-of-line accessors, and never
+// reads a thread_local after it may have switched.
+__attribute__((noinline)) static void setNestedFrame(NestedFrame* frame) {
+    nested_frame = frame;
+}
+
+__attribute__((noinline)) static void switchToScheduler(Fiber* fiber) {
+    swapcontext(&fiber -> context, fiber -> scheduler);
+}
+
+static bool timerAfter(const FiberTimer& a, const FiberTimer& b) {
+    return a.wake_time > b.wake_time;
+}
+
+// Entry point of every fiber.  Runs the index it was started with and
+// more indices of the same launch, then switches back to its thread and
+// waits to be handed the next index.
+static void fiberMain() {
+    Fiber* fiber = current_fiber;
+    TaskSystemParallelThreadPoolFibers* pool = fiber -> pool;
+    while (true) {
+        Task* task = fiber -> task;
+        int index = fiber -> index;
+        int total = task -> num_total_tasks;
+        while (true) {
+            // Indices of a cancelled launch are claimed but not run.
+            if (!dropsTasks(task)) {
+                NestedFrame frame;
+                frame.system = pool;
+                frame.task = task;
+                frame.outer = nullptr;
+                setNestedFrame(&frame);
+                try {
+                    task -> runnable -> runTask(index, total);
+                } catch (...) {
+                    failLaunch(task);
+                }
+                setNestedFrame(nullptr);
+            }
+
+            // Claim the next index before giving this one up, since the
+            // record may be recycled once remaining reaches zero.
+            int next = pool -> num_ready_fibers > 0 ? total : task -> next_index ++;
+            if (next == total - 1) {
+                std::lock_guard<std::mutex> lock(*pool -> fiber_mutex);
+                pool -> retireLaunch(task);
+            }
+            if (task -> remaining.fetch_sub(1) == 1) {
+                pool -> completeLaunch(task);
+            }
+            if (next >= total) {
+                break;
+            }
+            index = next;
+        }
+        fiber -> state = FIBER_DONE;
+        switchToScheduler(fiber);
+    }
+}
+
+const char* TaskSystemParallelThreadPoolFibers::name() {
+    return "Parallel + Thread Pool + Fibers";
+}
+
+TaskSystemParallelThreadPoolFibers::TaskSystemParallelThreadPoolFibers(int num_threads, PinPolicy pin_policy): ITaskSystem(num_threads) {
+    this -> num_threads = num_threads;
+    this -> killed = false;
+    this -> outstanding_launches = 0;
+    this -> num_ready_fibers = 0;
+    this -> running_fibers = 0;
+    this -> placement = Topology::system().place(pin_policy, num_threads);
+    this -> fiber_mutex = new std::mutex();
+    this -> sync_mutex = new std::mutex();
+    this -> work_cr = new std::condition_variable();
+    this -> sync_cr = new std::condition_variable();
+    for(int i = 0; i < num_threads; i++){
+        this -> pool.push_back(std::thread(&TaskSystemParallelThreadPoolFibers::workThread, this, i));
+    }
+}
+
+TaskSystemParallelThreadPoolFibers::~TaskSystemParallelThreadPoolFibers() {
+    // An exception nobody has synced for is dropped with the pool.
+    try {
+        sync();
+    } catch (...) {
+    }
+    fiber_mutex -> lock();
+    killed = true;
+    fiber_mutex -> unlock();
+    work_cr -> notify_all();
+    for(int i = 0; i < num_threads; i++){
+        pool[i].join();
+    }
+    for(auto fiber : fibers) {
+        munmap(fiber -> stack, fiber -> stack_size);
+        delete fiber;
+    }
+    delete fiber_mutex;
+    delete sync_mutex;
+    delete work_cr;
+    delete sync_cr;
+}
+
+void TaskSystemParallelThreadPoolFibers::run(IRunnable* runnable, int num_total_tasks) {
+    runAsyncWithDeps(runnable, num_total_tasks, {});
+    sync();
+}
+
+TaskID TaskSystemParallelThreadPoolFibers::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                            const std::vector<TaskID>& deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, false);
+}
+
+TaskID TaskSystemParallelThreadPoolFibers::runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                                            const std::vector<TaskID>& deps) {
+    return submitLaunch(runnable, num_total_tasks, deps, true);
+}
+
+TaskID TaskSystemParallelThreadPoolFibers::submitLaunch(IRunnable* runnable, int num_total_tasks,
+                                                        const std::vector<TaskID>& deps, bool wait_any) {
+    Task* task = launches.allocate(runnable, num_total_tasks);
+    TaskID task_id = task -> id;
+    if (NestedFrame* frame = currentFrame(this)) {
+        frame -> children.push_back(task_id);
+    }
+    outstanding_launches ++;
+
+    // Hold one extra count so the launch cannot be released by a
+    // predecessor finishing while its edges are still being added.
+    task -> unfinished_deps = 1;
+    if (wait_any) {
+        linkAnyDeps(launches, errors, task, deps);
+    } else {
+        for(auto dep : deps) {
+            Task* pred = launches.find(dep);
+            if (pred == nullptr) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(pred -> successors_mutex);
+            if (pred -> id == dep && !pred -> finished) {
+                pred -> successors.push_back(task);
+                task -> unfinished_deps ++;
+            } else {
+                inheritFailure(errors, task, dep);
+            }
+        }
+    }
+    if (-- task -> unfinished_deps == 0) {
+        scheduleLaunch(task);
+    }
+    return task_id;
+}
+
+void TaskSystemParallelThreadPoolFibers::sync() {
+    // From inside a task, only the launches that task submitted.
+    if (NestedFrame* frame = currentFrame(this)) {
+        std::vector<TaskID> children;
+        children.swap(frame -> children);
+        wait(children);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(*sync_mutex);
+    while (outstanding_launches > 0) {
+        sync_cr -> wait(lock);
+    }
+    lock.unlock();
+    errors.rethrowUnreported();
+}
+
+void TaskSystemParallelThreadPoolFibers::wait(TaskID task_id) {
+    wait(std::vector<TaskID>{task_id});
+}
+
+// A fiber of this pool parks until each launch is done; other threads
+// sleep on sync_cr.
+void TaskSystemParallelThreadPoolFibers::wait(const std::vector<TaskID>& task_ids) {
+    Fiber* fiber = current_fiber;
+    if (fiber != nullptr && fiber -> pool == this) {
+        for (auto task_id : task_ids) {
+            waitFiber(fiber, task_id);
+        }
+        errors.rethrowFor(task_ids);
+        return;
+    }
+
+    std::vector<TaskID> pending;
+    for (auto task_id : task_ids) {
+        Task* task = launches.find(task_id);
+        if (task == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(task -> successors_mutex);
+        if (task -> id == task_id && !task -> finished) {
+            task -> has_waiter = true;
+            pending.push_back(task_id);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(*sync_mutex);
+    while (!pending.empty()) {
+        if (isDone(pending.back())) {
+            pending.pop_back();
+            continue;
+        }
+        sync_cr -> wait(lock);
+    }
+    lock.unlock();
+    errors.rethrowFor(task_ids);
+}
+
+bool TaskSystemParallelThreadPoolFibers::isDone(TaskID task_id) {
+    Task* task = launches.find(task_id);
+    if (task == nullptr) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(task -> successors_mutex);
+    return task -> id != task_id || task -> finished;
+}
+
+void TaskSystemParallelThreadPoolFibers::cancel(TaskID task_id) {
+    cancelLaunch(launches, task_id);
+}
+
+// Parks `fiber` until launch `task_id` is done.
+void TaskSystemParallelThreadPoolFibers::waitFiber(Fiber* fiber, TaskID task_id) {
+    Task* task = launches.find(task_id);
+    if (task == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(task -> successors_mutex);
+        if (task -> id != task_id || task -> finished) {
+            return;
+        }
+        task -> has_waiter = true;
+    }
+    fiber -> state = FIBER_WAITING;
+    fiber -> wait_id = task_id;
+    switchToScheduler(fiber);
+}
+
+void TaskSystemParallelThreadPoolFibers::sleepFiber(Fiber* fiber, std::chrono::microseconds duration) {
+    fiber -> state = FIBER_SLEEPING;
+    fiber -> wake_time = std::chrono::steady_clock::now() + duration;
+    switchToScheduler(fiber);
+}
+
+void TaskSystemParallelThreadPoolFibers::workThread(int thread_number) {
+    pinCurrentThread(placement[thread_number].cpus);
+    ucontext_t scheduler;
+    std::unique_lock<std::mutex> lock(*fiber_mutex);
+
+    while (true) {
+        Fiber* fiber = nextFiber();
+        if (fiber == nullptr) {
+            if (killed) {
+                break;
+            }
+            if (timers.empty()) {
+                work_cr -> wait(lock);
+                continue;
+            }
+            std::chrono::steady_clock::time_point wake_time = timers.front().wake_time;
+            if (wake_time - std::chrono::steady_clock::now() < FIBER_SPIN_WINDOW) {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            } else {
+                work_cr -> wait_until(lock, wake_time);
+            }
+            continue;
+        }
+        lock.unlock();
+
+        fiber -> scheduler = &scheduler;
+        current_fiber = fiber;
+        nested_frame = fiber -> frame;
+        swapcontext(&scheduler, &fiber -> context);
+        fiber -> frame = nested_frame;
+        nested_frame = nullptr;
+        current_fiber = nullptr;
+
+        lock.lock();
+        parkFiber(fiber);
+    }
+}
+
+// Picks the fiber to run next: a fiber ready to resume, a sleeping fiber
+// whose time has come, or a fresh fiber for the next index of the oldest
+// ready launch.  Called with fiber_mutex held.
+Fiber* TaskSystemParallelThreadPoolFibers::nextFiber() {
+    if (!timers.empty()) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        while (!timers.empty() && timers.front().wake_time <= now) {
+            ready_fibers.push_back(timers.front().fiber);
+            num_ready_fibers ++;
+            std::pop_heap(timers.begin(), timers.end(), timerAfter);
+            timers.pop_back();
+        }
+    }
+    if (!ready_fibers.empty()) {
+        Fiber* fiber = ready_fibers.front();
+        ready_fibers.pop_front();
+        num_ready_fibers --;
+        return fiber;
+    }
+
+    if (running_fibers >= FIBER_LIMIT) {
+        return nullptr;
+    }
+    // A launch whose indices have all been claimed stays queued until the
+    // fiber that claimed the last one retires it.
+    for (Task* task : ready_launches) {
+        int index = task -> next_index ++;
+        if (index >= task -> num_total_tasks) {
+            continue;
+        }
+        if (index == task -> num_total_tasks - 1) {
+            retireLaunch(task);
+        }
+        Fiber* fiber = newFiber();
+        fiber -> task = task;
+        fiber -> index = index;
+        running_fibers ++;
+        return fiber;
+    }
+    return nullptr;
+}
+
+// Takes a fiber from the free list, or creates one whose stack has an
+// inaccessible guard page at its low end.  Called with fiber_mutex held.
+Fiber* TaskSystemParallelThreadPoolFibers::newFiber() {
+    if (!free_fibers.empty()) {
+        Fiber* fiber = free_fibers.back();
+        free_fibers.pop_back();
+        fiber -> state = FIBER_RUNNING;
+        return fiber;
+    }
+
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    Fiber* fiber = new Fiber();
+    fiber -> pool = this;
+    fiber -> stack_size = FIBER_STACK_SIZE + page;
+    void* stack = mmap(nullptr, fiber -> stack_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) {
+        delete fiber;
+        throw std::bad_alloc();
+    }
+    fiber -> stack = static_cast<char*>(stack);
+    mprotect(fiber -> stack, page, PROT_NONE);
+
+    getcontext(&fiber -> context);
+    fiber -> context.uc_stack.ss_sp = fiber -> stack + page;
+    fiber -> context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber -> context.uc_link = nullptr;
+    makecontext(&fiber -> context, fiberMain, 0);
+    fiber -> state = FIBER_RUNNING;
+    fiber -> frame = nullptr;
+    fibers.push_back(fiber);
+    return fiber;
+}
+
+// Files a fiber that has just switched out according to why it did.
+// Called with fiber_mutex held, on the thread it switched back to.
+void TaskSystemParallelThreadPoolFibers::parkFiber(Fiber* fiber) {
+    if (fiber -> state == FIBER_DONE) {
+        running_fibers --;
+        free_fibers.push_back(fiber);
+    } else if (fiber -> state == FIBER_SLEEPING) {
+        timers.push_back(FiberTimer{fiber -> wake_time, fiber});
+        std::push_heap(timers.begin(), timers.end(), timerAfter);
+    } else if (fiber -> state == FIBER_WAITING) {
+        // completeLaunch() marks the launch finished before it looks for
+        // waiters under fiber_mutex, so either that happens after this or
+        // the launch is already seen as done here.
+        running_fibers --;
+        if (isDone(fiber -> wait_id)) {
+            resumeFiber(fiber);
+        } else {
+            launch_waiters[fiber -> wait_id].push_back(fiber);
+        }
+    }
+}
+
+// Makes a parked fiber runnable.  Called with fiber_mutex held.
+void TaskSystemParallelThreadPoolFibers::resumeFiber(Fiber* fiber) {
+    if (fiber -> state == FIBER_WAITING) {
+        running_fibers ++;
+    }
+    fiber -> state = FIBER_RUNNING;
+    ready_fibers.push_back(fiber);
+    num_ready_fibers ++;
+    work_cr -> notify_one();
+}
+
+// Removes a launch whose last index has been claimed from the ready
+// queue.  The claimer calls this before finishing that index, so the
+// record is never released while it is still queued.  Called with
+// fiber_mutex held.
+void TaskSystemParallelThreadPoolFibers::retireLaunch(Task* task) {
+    ready_launches.erase(std::find(ready_launches.begin(), ready_launches.end(), task));
+}
+
+void TaskSystemParallelThreadPoolFibers::scheduleLaunch(Task* task) {
+    if (task -> num_total_tasks <= 0) {
+        completeLaunch(task);
+        return;
+    }
+    fiber_mutex -> lock();
+    ready_launches.push_back(task);
+    fiber_mutex -> unlock();
+    if (task -> num_total_tasks == 1) {
+        work_cr -> notify_one();
+    } else {
+        work_cr -> notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolFibers::completeLaunch(Task* task) {
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> ready;
+    SmallVector<Task*, TASK_INLINE_SUCCESSORS> fired;
+    LaunchError* error = task -> error;
+    if (error != nullptr) {
+        errors.recordFailure(task -> id, error);
+    }
+    task -> successors_mutex.lock();
+    task -> finished = true;
+    TaskID task_id = task -> id;
+    bool has_waiter = task -> has_waiter;
+    bool cancelled = task -> cancelled;
+    for (Task* successor : task -> successors) {
+        if (successor -> wait_any) {
+            // Only the predecessor that fires an any-of launch decides
+            // whether it is cancelled or failed.
+            if (successor -> any_armed.exchange(false)) {
+                if (cancelled) {
+                    cancelSuccessor(successor, error);
+                }
+                fired.push_back(successor);
+            }
+            continue;
+        }
+        if (cancelled) {
+            cancelSuccessor(successor, error);
+        }
+        if (-- successor -> unfinished_deps == 0) {
+            ready.push_back(successor);
+        }
+    }
+    task -> successors.clear();
+    task -> successors_mutex.unlock();
+    releaseFailure(task);
+
+    for (Task* successor : fired) {
+        if (fireAny(successor)) {
+            ready.push_back(successor);
+        }
+    }
+    for (Task* successor : ready) {
+        scheduleLaunch(successor);
+    }
+
+    if (has_waiter) {
+        std::lock_guard<std::mutex> lock(*fiber_mutex);
+        auto waiters = launch_waiters.find(task_id);
+        if (waiters != launch_waiters.end()) {
+            for (Fiber* fiber : waiters -> second) {
+                resumeFiber(fiber);
+            }
+            launch_waiters.erase(waiters);
+        }
+    }
+
+    launches.release(task);
+
+    if (-- outstanding_launches == 0 || has_waiter) {
+        sync_mutex -> lock();
+        sync_mutex -> unlock();
+        sync_cr -> notify_all();
+    }
+}
+
+void taskSleepFor(std::chrono::microseconds duration) {
+    Fiber* fiber = current_fiber;
+    if (fiber != nullptr) {
+        fiber -> pool -> sleepFiber(fiber, duration);
+        return;
+    }
+    BlockingRegion blocking;
+    std::this_thread::sleep_for(duration);
+}
@@ -2,12 +2,18 @@
 #define _TASKSYS_H
 
 #include "itasksys.h"
-#include <map>
-#include <set>
+#include "WorkStealingDeque.h"
+#include "SmallVector.h"
+#include "Topology.h"
+#include <atomic>
+#include <chrono>
 #include <deque>
+#include <exception>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <unordered_map>
+#include <ucontext.h>
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -59,69 +65,620 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
         void sync();
 };
 
+class Task;
+class TaskGraph;
+class IndexEdge;
+class LaunchError;
+
 /*
- * TaskSystemParallelThreadPoolSleeping: This class is the student's
- * optimized implementation of a parallel task execution engine that uses
- * a thread pool. See definition of ITaskSystem in
- * itasksys.h for documentation of the ITaskSystem interface.
+ * IndexDependency: a dependency of each task of a launch on only some
+ * tasks of an earlier launch, instead of on all of them.
+ *
+ *  - INDEX_ONE_TO_ONE: task i needs task i of `launch`.
+ *  - INDEX_STENCIL: task i needs tasks i - radius .. i + radius.
+ *  - INDEX_MAP: task i needs task index_map[i].
+ *
+ * Indices outside the earlier launch are ignored.  An earlier launch that
+ * has already started running when the dependency is added is waited for
+ * as a whole.
+ */
+enum IndexDependencyKind {
+    INDEX_ONE_TO_ONE,
+    INDEX_STENCIL,
+    INDEX_MAP,
+};
+
+class IndexDependency {
+    public:
+        TaskID launch;
+        IndexDependencyKind kind;
+        int radius;
+        std::vector<int> index_map;
+
+        IndexDependency(TaskID launch, IndexDependencyKind kind = INDEX_ONE_TO_ONE, int radius = 0)
+            : launch(launch), kind(kind), radius(radius) {}
+        IndexDependency(TaskID launch, const std::vector<int>& index_map)
+            : launch(launch), kind(INDEX_MAP), radius(0), index_map(index_map) {}
+};
+
+/*
+ * TaskRef: a launch record together with the id it had when the
+ * reference was taken, to detect that the record has been recycled.
+ */
+class TaskRef {
+    public:
+        Task* task;
+        TaskID id;
+};
+
+/*
+ * Task: one bulk launch.  The launch is queued as a single range
+ * descriptor; workers claim task indices from it through next_index and
+ * the worker that brings remaining to zero retires the launch.
+ *
+ * Records are cache-line aligned so the counters of different launches
+ * never share a line.  Most launches have few successors, so they are
+ * kept inline.
+ *
+ * bottom_level is the cost of the launch plus the most expensive chain of
+ * launches submitted so far that depend on it.  The sleeping pool runs
+ * ready launches with the highest bottom_level first.
  */
+#define TASK_INLINE_SUCCESSORS 4
 
-class Task {
+class alignas(64) Task {
     public:
         TaskID id;
         IRunnable* runnable;
         int num_total_tasks;
+        std::atomic<bool> finished;
+        // Set by wait() so completion also wakes the waiting thread.
+        bool has_waiter;
+        std::atomic<int> next_index;
+        std::atomic<int> remaining;
+        std::atomic<int> unfinished_deps;
+        // Set for a launch from runAsyncAfterAny(): the first predecessor
+        // to finish clears any_armed and takes the launch's one count of
+        // unfinished_deps for all of them.
+        bool wait_any;
+        std::atomic<bool> any_armed;
+        // Set by cancel(), by a task that throws, or by a cancelled
+        // predecessor finishing, or finishing a task this launch's tasks
+        // depend on.  Indices claimed after it is set are dropped, unless
+        // the runnable runsWhenCancelled().
+        std::atomic<bool> cancelled;
+        // First exception thrown out of a task of this launch, or of a
+        // failed predecessor.  The launch holds a reference to it until
+        // it completes.
+        std::atomic<LaunchError*> error;
+        SmallVector<Task*, TASK_INLINE_SUCCESSORS> successors;
+        SmallVector<TaskRef, TASK_INLINE_SUCCESSORS> predecessors;
+        double cost;
+        std::atomic<double> bottom_level;
+        // Snapshot of bottom_level and arrival order in the ready queue.
+        double ready_priority;
+        int64_t ready_order;
+        // Graph this record is a node of, or nullptr for a plain launch.
+        TaskGraph* graph;
+        // Per-index dependencies.  Launches with index_scheduled set are
+        // claimed from ready_indices rather than next_index; index_waits
+        // counts the unfinished predecessor tasks of each index.  All of
+        // these are guarded by the pool's task_run_mutex.
+        SmallVector<IndexEdge*, TASK_INLINE_SUCCESSORS> index_successors;
+        bool index_scheduled;
+        bool launch_ready;
+        bool queued;
+        std::vector<int> index_waits;
+        std::vector<int> ready_indices;
+        std::mutex successors_mutex;
 
-        Task(TaskID id, IRunnable* runnable, int num_total_tasks){
+        Task(TaskID id){
             this -> id = id;
+            reuse(nullptr, 0);
+        }
+
+        // Readies a retired record for a new launch.  The id is left
+        // alone; whoever retired the record has already advanced it.
+        void reuse(IRunnable* runnable, int num_total_tasks){
             this -> runnable = runnable;
             this -> num_total_tasks = num_total_tasks;
+            this -> finished = false;
+            this -> has_waiter = false;
+            this -> next_index = 0;
+            this -> remaining = num_total_tasks;
+            this -> unfinished_deps = 0;
+            this -> wait_any = false;
+            this -> any_armed = false;
+            this -> cancelled = false;
+            this -> error = nullptr;
+            this -> predecessors.clear();
+            this -> cost = num_total_tasks;
+            this -> bottom_level = num_total_tasks;
+            this -> graph = nullptr;
+            this -> index_successors.clear();
+            this -> index_scheduled = false;
+            this -> launch_ready = false;
+            this -> queued = false;
+            this -> index_waits.clear();
+            this -> ready_indices.clear();
         }
+};
+
+/*
+ * IndexEdge: an IndexDependency as seen from the earlier launch, which
+ * owns it until it completes.  inverse_map lists the dependent successor
+ * tasks of each task under INDEX_MAP.
+ */
+class IndexEdge {
+    public:
+        Task* successor;
+        int successor_tasks;
+        IndexDependencyKind kind;
+        int radius;
+        std::vector<std::vector<int>> inverse_map;
+};
 
-        Task(const Task &other){
-            this -> id = other.id;
-            this -> runnable = other.runnable;
-            this -> num_total_tasks = other.num_total_tasks;
+/*
+ * CapturedLaunch: one runAsyncWithDeps() call recorded between
+ * beginCapture() and endCapture().  deps are indices of earlier captured
+ * launches.
+ */
+class CapturedLaunch {
+    public:
+        IRunnable* runnable;
+        int num_total_tasks;
+        double cost;
+        std::vector<int> deps;
+};
+
+/*
+ * TaskGraph: an immutable, pre-resolved graph of launches built by
+ * endCapture().  Each node is a launch record of its own whose successor
+ * list and bottom level are filled in once, so launching the graph only
+ * resets counters and queues the roots.
+ *
+ * A graph can only be running once at a time; launchGraph() waits for the
+ * previous launch of the same graph.  Delete a graph only while it is not
+ * running.
+ */
+class TaskGraph {
+    public:
+        Task* nodes;
+        int num_nodes;
+        std::vector<int> in_degrees;
+        std::vector<int> roots;
+        std::atomic<int> running_nodes;
+
+        TaskGraph(const std::vector<CapturedLaunch>& captured);
+        ~TaskGraph();
+};
+
+/*
+ * LaunchTable: launch records indexed by TaskID.  Records are allocated
+ * in contiguous blocks of LAUNCH_TABLE_BLOCK and recycled as soon as
+ * their launch finishes, so the table only grows with the number of
+ * launches in flight.
+ *
+ * A TaskID is the record's slot in the low 32 bits and the number of
+ * times the slot has been recycled, modulo 2^31, above them, so ids are
+ * never negative.  A record whose id no longer matches a TaskID has moved
+ * on, so that launch is finished; compare ids under successors_mutex.
+ */
+#define LAUNCH_TABLE_BLOCK 64
+
+class LaunchTable {
+    public:
+        // Block directory, read by find() without a lock: num_blocks is
+        // published after the directory and its entries, so a reader that
+        // loads num_blocks first sees at least that many blocks.  Outgrown
+        // directories are kept until the table is destroyed, since a
+        // reader may still be using one.
+        std::atomic<Task**> directory;
+        std::atomic<int> num_blocks;
+        int directory_size;
+        std::vector<Task**> retired_directories;
+        std::vector<int> free_slots;
+        // Guards free_slots and growing the directory.
+        std::mutex* table_mutex;
+
+        LaunchTable();
+        ~LaunchTable();
+        Task* allocate(IRunnable* runnable, int num_total_tasks);
+        Task* find(TaskID task_id);
+        void release(Task* task);
+        int capacity();
+};
+
+/*
+ * LaunchError: an exception thrown out of runTask(), shared by the launch
+ * that threw it, the launches cancelled by its failure and the pool's
+ * LaunchErrors.  Each holds a reference, and the last to let go frees it.
+ * `reported` is set once wait() has rethrown it, guarded by errors_mutex.
+ */
+class LaunchError {
+    public:
+        std::exception_ptr exception;
+        std::atomic<int> refs;
+        bool reported;
+
+        LaunchError(std::exception_ptr exception) : exception(exception), refs(1), reported(false) {}
+
+        void retain() {
+            refs ++;
+        }
+
+        void release() {
+            if (-- refs == 0) {
+                delete this;
+            }
         }
 };
 
-class RunnableTask : public Task {
+/*
+ * LaunchErrors: failures of the launches of a pool.  `failed` maps
+ * finished failed launches to their exception for wait() and for
+ * launches depending on them, and `unreported` is the first exception the
+ * next sync() is to rethrow.  A failure wait() has reported is forgotten,
+ * also for launches it cancelled that finish later, as sync() forgets all
+ * of them.  any_failed is set while either holds anything, so the lookups
+ * skip the lock in the common case.
+ */
+class LaunchErrors {
     public:
-        int current_task_id;
-    
-        RunnableTask(TaskID id, TaskID curent_task_id, IRunnable* runnable, int num_total_tasks)
-            : Task(id, runnable, num_total_tasks), current_task_id(current_task_id) {}
-        
-        RunnableTask(const RunnableTask &other)
-            : Task(other.id, other.runnable, other.num_total_tasks), current_task_id(other.current_task_id) {}
+        std::unordered_map<TaskID, LaunchError*> failed;
+        LaunchError* unreported;
+        std::atomic<bool> any_failed;
+        std::mutex* errors_mutex;
+
+        LaunchErrors();
+        ~LaunchErrors();
+        void recordFailure(TaskID task_id, LaunchError* error);
+        LaunchError* failureOf(TaskID task_id);
+        void rethrowFor(const std::vector<TaskID>& task_ids);
+        void rethrowUnreported();
 };
 
+/*
+ * IdleSlot: where one thread of the sleeping pool blocks while it has
+ * nothing to run.  The first num_threads slots belong to the pool threads.
+ * Spare threads, and threads calling sync() or wait() from outside the
+ * pool, have slots after those; an outside thread holds its slot only for
+ * the duration of the call.  waiting is set while the owner is inside
+ * wait(), so finishing a waited-for launch wakes it.
+ */
+class IdleSlot {
+    public:
+        std::condition_variable cv;
+        bool woken;
+        bool waiting;
+        IdleSlot() : woken(false), waiting(false) {}
+};
+
+/*
+ * TaskSystemParallelThreadPoolSleeping: This class is the student's
+ * optimized implementation of a parallel task execution engine that uses
+ * a thread pool. See definition of ITaskSystem in
+ * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * The thread calling sync() executes ready tasks alongside the pool.  When
+ * count_caller_as_worker is set, that thread counts towards num_threads
+ * and only num_threads - 1 pool threads are created.  pin_policy places
+ * the pool threads on CPUs (see Topology.h).
+ *
+ * Idle threads push their slot on idle_slots and sleep on their own
+ * condition variable.  A new launch wakes at most one thread per task
+ * index from the top of that stack, and a thread that claims an index
+ * while more are queued wakes the next one, so small launches do not wake
+ * the whole pool.
+ *
+ * Ready launches are kept in a heap ordered by bottom level, so the launch
+ * heading the longest remaining chain of work runs first.  The cost of a
+ * launch defaults to num_total_tasks; runAsyncWithDeps() takes a cost
+ * hint for launches whose tasks are unusually light or heavy.  Bottom
+ * levels are propagated PRIORITY_PROPAGATION_DEPTH launches up the graph
+ * at submission, which keeps deep chains from making submission
+ * quadratic, and are read when a launch becomes ready.
+ *
+ * Between beginCapture() and endCapture(), runAsyncWithDeps() records
+ * launches instead of running them and returns their index in the
+ * capture; deps may only name launches of the same capture.  The
+ * resulting TaskGraph is run with launchGraph() and waited for with
+ * sync().  Captured runAsyncAfterAny() launches wait for all their deps.
+ * Only launches from the thread that called beginCapture() are captured,
+ * and not those from tasks it runs meanwhile; one capture at a time.
+ *
+ * runAsyncWithDeps() also takes IndexDependency lists, so a task can start
+ * as soon as the tasks it reads from have finished rather than the whole
+ * earlier launch.
+ *
+ * Tasks may themselves call run(), runAsyncWithDeps(), sync() and wait().
+ * From inside a task, sync() waits only for the launches that task
+ * submitted, and a blocked caller runs other ready work meanwhile.
+ *
+ * While tasks are inside a BlockingRegion, up to one spare thread per
+ * blocked task runs ready work in their place.  Spares are started on
+ * demand, at most num_threads of them, and park when no longer needed.
+ */
+#define PRIORITY_PROPAGATION_DEPTH 16
+
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
         bool killed;
         int num_threads;
-        int current_task_id;
-        std::map<TaskID, std::set<TaskID>> tasks_dep;
-        std::map<TaskID, Task*> task_id_to_task;
-        std::map<TaskID, int> remaining_tasks;
-        std::deque<RunnableTask*> runnable_tasks;
-        std::deque<TaskID> finished_tasks;
+        LaunchTable launches;
+        LaunchErrors errors;
+        std::atomic<int> outstanding_launches;
+        std::vector<Task*> runnable_tasks;
+        int64_t ready_sequence;
         std::vector<std::thread> pool;
+        std::vector<WorkerPlacement> placement;
         std::mutex* task_run_mutex;
-        std::mutex* finished_task_mutex;
-        std::condition_variable* task_run_cr;
-        std::condition_variable* finished_task_cr;
+        std::vector<IdleSlot*> slots;
+        std::vector<int> idle_slots;
+        // Slots of the outside threads inside sync() or wait(), and those
+        // left over from earlier calls.
+        std::vector<int> caller_slots;
+        std::vector<int> free_caller_slots;
+        // Only touched by the thread capturing.
+        std::vector<CapturedLaunch> captured;
+        int blocked_threads;
+        int running_spares;
+        std::vector<std::thread> spares;
+        std::vector<int> parked_spares;
 
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads, bool count_caller_as_worker = false,
+                                             PinPolicy pin_policy = PIN_NONE);
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps, double cost);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps,
+                                const std::vector<IndexDependency>& index_deps);
+        TaskID runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+        void wait(TaskID task_id);
+        void wait(const std::vector<TaskID>& task_ids);
+        bool isDone(TaskID task_id);
+        void cancel(TaskID task_id);
+        void beginCapture();
+        TaskGraph* endCapture();
+        void launchGraph(TaskGraph* graph);
+        void beginBlocking();
+        void endBlocking();
+        void workThread(int thread_number);
+        void spareThread(int slot);
+        void runNextTask(std::unique_lock<std::mutex>& task_run_lock);
+        void waitForWork(int slot, std::unique_lock<std::mutex>& task_run_lock);
+        void wakeIdleThreads(int count);
+        void wakeSlot(int slot);
+        int acquireCallerSlot();
+        void releaseCallerSlot(int slot);
+        void raiseBottomLevel(TaskRef pred, double successor_level, int depth);
+        TaskID submitLaunch(IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps,
+                            const std::vector<IndexDependency>& index_deps, double cost, bool wait_any);
+        bool addIndexDependency(Task* task, Task* pred, const IndexDependency& dep);
+        void finishIndex(Task* task, int index, LaunchError* error, bool cancelled);
+        void pushReady(Task* task);
+        void enqueueLaunch(Task* task);
+        void completeLaunch(Task* task);
+};
+
+/*
+ * TaskRange: a contiguous slice [begin, end) of the task indices of one
+ * bulk launch, as stored in the work-stealing deques.
+ */
+class TaskRange {
+    public:
+        Task* task;
+        int begin;
+        int end;
+
+        TaskRange(Task* task, int begin, int end){
+            this -> task = task;
+            this -> begin = begin;
+            this -> end = end;
+        }
+};
+
+/*
+ * TaskSystemParallelThreadPoolStealing: a thread pool where each worker
+ * owns a Chase-Lev deque of task ranges.  Workers split large ranges in
+ * half, push the upper half locally and steal from random victims when
+ * their own deque runs dry.  Launches released by a worker are pushed
+ * onto that worker's deque; launches submitted from outside the pool go
+ * through the injection queue of the submitting thread's NUMA node.
+ *
+ * Workers are grouped by the node pin_policy places them on.  A worker
+ * out of work looks at its own node's injection queue and workers before
+ * trying another node.  Without pinning all workers form one node.
+ *
+ * Tasks may submit and wait for launches of their own.  From inside a
+ * task, sync() waits only for the launches that task submitted, and the
+ * waiting worker keeps running and stealing work until they are done.
+ *
+ * While tasks are inside a BlockingRegion, up to one spare worker per
+ * blocked task runs and steals work in their place.  Spares, at most
+ * num_threads of them, have deques of their own after those of the pool
+ * threads and park when no longer needed.
+ */
+class NodeQueue {
+    public:
+        std::mutex mutex;
+        std::deque<TaskRange*> ranges;
+        std::atomic<int> size;
+        NodeQueue() : size(0) {}
+};
+
+class TaskSystemParallelThreadPoolStealing: public ITaskSystem {
+    public:
+        std::atomic<bool> killed;
+        int num_threads;
+        int num_nodes;
+        LaunchTable launches;
+        LaunchErrors errors;
+        std::vector<WorkStealingDeque<TaskRange>*> deques;
+        std::vector<NodeQueue*> injected;
+        std::vector<WorkerPlacement> placement;
+        std::vector<std::vector<int> > node_workers;
+        std::atomic<int> outstanding_launches;
+        std::atomic<int> num_sleeping;
+        std::vector<std::thread> pool;
+        int max_spares;
+        std::atomic<int> blocked_threads;
+        std::atomic<int> running_spares;
+        std::vector<std::thread> spares;
+        std::vector<int> parked_spares;
+        std::vector<char> spare_wanted;
+        std::mutex* idle_mutex;
+        std::mutex* sync_mutex;
+        std::mutex* spare_mutex;
+        std::condition_variable* idle_cr;
+        std::condition_variable* sync_cr;
+        std::condition_variable* spare_cr;
+
+        TaskSystemParallelThreadPoolStealing(int num_threads, PinPolicy pin_policy = PIN_NONE);
+        ~TaskSystemParallelThreadPoolStealing();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        TaskID runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+        void wait(TaskID task_id);
+        void wait(const std::vector<TaskID>& task_ids);
+        bool isDone(TaskID task_id);
+        void cancel(TaskID task_id);
+        void beginBlocking();
+        void endBlocking();
+        void workThread(int thread_number);
+        void parkSpare(int thread_number);
+        TaskRange* findWork(int thread_number, unsigned int* seed);
+        TaskRange* takeInjected(int node);
+        int submitNode();
+        TaskID submitLaunch(IRunnable* runnable, int num_total_tasks,
+                            const std::vector<TaskID>& deps, bool wait_any);
+        void executeRange(int thread_number, TaskRange* range);
+        void scheduleLaunch(Task* task);
+        void completeLaunch(Task* task);
+        void pushRange(TaskRange* range);
+        bool hasQueuedWork();
+};
+
+/*
+ * Fiber: a user-level thread that runs task indices of one launch at a
+ * time on a stack of its own.  Stacks are FIBER_STACK_SIZE bytes with an
+ * unmapped guard page below them, and fibers are pooled and reused for
+ * later launches.
+ *
+ * A fiber that has to wait records why in state (and wait_id or
+ * wake_time) and switches back to the thread that resumed it, which then
+ * files it under the launch or timer it waits for.  frame is the
+ * nested-launch frame of the task it was running when it switched out.
+ */
+#define FIBER_STACK_SIZE (64 * 1024)
+
+class NestedFrame;
+class TaskSystemParallelThreadPoolFibers;
+
+enum FiberState {
+    FIBER_RUNNING,
+    FIBER_DONE,
+    FIBER_WAITING,
+    FIBER_SLEEPING,
+};
+
+class Fiber {
+    public:
+        TaskSystemParallelThreadPoolFibers* pool;
+        ucontext_t context;
+        ucontext_t* scheduler;
+        char* stack;
+        size_t stack_size;
+        Task* task;
+        int index;
+        FiberState state;
+        TaskID wait_id;
+        std::chrono::steady_clock::time_point wake_time;
+        NestedFrame* frame;
+};
+
+class FiberTimer {
+    public:
+        std::chrono::steady_clock::time_point wake_time;
+        Fiber* fiber;
+};
+
+/*
+ * TaskSystemParallelThreadPoolFibers: an M:N task system.  Every task
+ * index runs on a fiber, and fibers are multiplexed over num_threads
+ * pool threads.  A fiber keeps claiming indices of its launch until they
+ * run out or another fiber is ready to resume.
+ *
+ * wait(), sync() and run() called from inside a task, and taskSleepFor(),
+ * park the calling fiber and let its thread run other fibers instead of
+ * blocking.  Parked fibers may resume on any pool thread, so tasks must
+ * not hold locks across these calls.  A BlockingRegion still blocks the
+ * thread and is not compensated.
+ *
+ * At most FIBER_LIMIT fibers hold task indices at a time, not counting
+ * fibers parked in wait(), so wide launches of sleeping tasks do not
+ * allocate a stack per index.
+ */
+#define FIBER_LIMIT 4096
+
+class TaskSystemParallelThreadPoolFibers: public ITaskSystem {
+    public:
+        bool killed;
+        int num_threads;
+        LaunchTable launches;
+        LaunchErrors errors;
+        std::atomic<int> outstanding_launches;
+        std::deque<Task*> ready_launches;
+        std::deque<Fiber*> ready_fibers;
+        std::atomic<int> num_ready_fibers;
+        std::vector<FiberTimer> timers;
+        std::unordered_map<TaskID, std::vector<Fiber*> > launch_waiters;
+        std::vector<Fiber*> fibers;
+        std::vector<Fiber*> free_fibers;
+        int running_fibers;
+        std::vector<std::thread> pool;
+        std::vector<WorkerPlacement> placement;
+        std::mutex* fiber_mutex;
+        std::mutex* sync_mutex;
+        std::condition_variable* work_cr;
+        std::condition_variable* sync_cr;
+
+        TaskSystemParallelThreadPoolFibers(int num_threads, PinPolicy pin_policy = PIN_NONE);
+        ~TaskSystemParallelThreadPoolFibers();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        TaskID runAsyncAfterAny(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
         void sync();
+        void wait(TaskID task_id);
+        void wait(const std::vector<TaskID>& task_ids);
+        bool isDone(TaskID task_id);
+        void cancel(TaskID task_id);
         void workThread(int thread_number);
-        void scanForReadyTasks();
-        void removeTaskIDFromDependency(TaskID i);
+        Fiber* nextFiber();
+        Fiber* newFiber();
+        void parkFiber(Fiber* fiber);
+        void resumeFiber(Fiber* fiber);
+        void sleepFiber(Fiber* fiber, std::chrono::microseconds duration);
+        void waitFiber(Fiber* fiber, TaskID task_id);
+        void retireLaunch(Task* task);
+        TaskID submitLaunch(IRunnable* runnable, int num_total_tasks,
+                            const std::vector<TaskID>& deps, bool wait_any);
+        void scheduleLaunch(Task* task);
+        void completeLaunch(Task* task);
 };
 
 #endif
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tasksys.h"
+#include "tests.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Benchmark of PARTITION_AFFINITY against PARTITION_DYNAMIC on the
+ * ping-pong and super-light tests, which touch the same slice of their
+ * buffers from the same task index in every launch.
+ *
+ * Cache misses of the whole process, pool threads included, are counted
+ * with perf_event_open.  Generic perf events have no notion of L2, so by
+ * default the benchmark counts L1D read misses, which are the requests
+ * that reach L2, and last-level misses.  Set AFFINITY_BENCH_L2_EVENT to
+ * the raw event code of L2 misses on the host CPU (for example 0x3f24,
+ * L2_RQSTS.MISS on recent Intel cores) to count those as well.
+ */
+
+#define NUM_THREADS 8
+
+class MissCounter {
+    public:
+        const char* label;
+        int fd;
+
+        MissCounter(const char* label, uint32_t type, uint64_t config) : label(label), fd(-1) {
+#if defined(__linux__)
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+        }
+
+        ~MissCounter() {
+#if defined(__linux__)
+            if (fd >= 0) {
+                close(fd);
+            }
+#endif
+        }
+
+        void start() {
+#if defined(__linux__)
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        // Returns -1 when the counter could not be opened.
+        long long stop() {
+            long long count = -1;
+#if defined(__linux__)
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                    count = -1;
+                }
+            }
+#endif
+            return count;
+        }
+};
+
+static void runConfig(const char* test_name, TestResults (*test)(ITaskSystem*),
+                      const char* partitioner_name, const Partitioner& partitioner,
+                      std::vector<uint64_t>& raw_events) {
+    std::vector<MissCounter*> counters;
+#if defined(__linux__)
+    counters.push_back(new MissCounter("L1D misses", PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)));
+    counters.push_back(new MissCounter("LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES));
+    for (uint64_t event : raw_events) {
+        counters.push_back(new MissCounter("L2 misses", PERF_TYPE_RAW, event));
+    }
+#endif
+
+    // Counters inherit into threads created after they are opened, so the
+    // pool is built afterwards.
+    TaskSystemParallelThreadPoolSleeping* t = new TaskSystemParallelThreadPoolSleeping(NUM_THREADS);
+    t -> setPartitioner(partitioner);
+    for (MissCounter* counter : counters) {
+        counter -> start();
+    }
+    TestResults result = test(t);
+    printf("%-18s %-9s %8.2f ms %s", test_name, partitioner_name, result.time * 1000,
+           result.passed ? "" : "(FAILED) ");
+    for (MissCounter* counter : counters) {
+        long long count = counter -> stop();
+        if (count >= 0) {
+            printf(" %s %12lld", counter -> label, count);
+        } else {
+            printf(" %s %12s", counter -> label, "n/a");
+        }
+        delete counter;
+    }
+    printf("\n");
+    delete t;
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint64_t> raw_events;
+    const char* l2_event = getenv("AFFINITY_BENCH_L2_EVENT");
+    if (l2_event != NULL) {
+        raw_events.push_back(strtoull(l2_event, NULL, 0));
+    }
+
+    const char* test_names[] = {"ping_pong_equal", "ping_pong_unequal", "super_light"};
+    TestResults (*tests[])(ITaskSystem*) = {pingPongEqualTest, pingPongUnequalTest, superLightTest};
+
+    for (int i = 0; i < 3; i++) {
+        runConfig(test_names[i], tests[i], "dynamic", Partitioner(PARTITION_DYNAMIC), raw_events);
+        runConfig(test_names[i], tests[i], "affinity", Partitioner(PARTITION_AFFINITY), raw_events);
+    }
+    return 0;
+}
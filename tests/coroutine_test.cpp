@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+#include "TaskCoroutines.h"
+
+/*
+ * Chains of stages sequenced by coroutines instead of sync() calls.  Each
+ * stage is a bulk launch that checks every element was written by the
+ * previous stage and then writes its own stage number.  The main thread
+ * starts all chains and only calls sync() once at the end; no thread
+ * blocks between stages.
+ *
+ * Where each stage resumes is checked per system: on a pool thread for the
+ * stealing and fiber pools, on the starting thread for the serial system,
+ * whose launches are done before they can be awaited.  The sleeping pool's
+ * sync() runs ready launches on its caller, so there continuations resume
+ * on either and the count is only reported.
+ *
+ * A second test awaits a launch that is cancelled meanwhile, and one whose
+ * task throws.  The first coroutine must be resumed and end, the second
+ * must catch the exception from co_await, and sync() must have nothing
+ * left to report.
+ */
+
+#define NUM_THREADS 8
+#define NUM_CHAINS 4
+#define NUM_STAGES 500
+#define STAGE_WIDTH 16
+
+enum ResumeThreads {
+    RESUME_ON_WORKERS,
+    RESUME_ON_STARTER,
+    RESUME_ANYWHERE,
+};
+
+class StageTask: public IRunnable {
+    public:
+        int* data_;
+        int stage_;
+        std::atomic<int>* errors_;
+        StageTask(int* data, int stage, std::atomic<int>* errors)
+            : data_(data), stage_(stage), errors_(errors) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (data_[task_id] != stage_ - 1) {
+                (*errors_)++;
+            }
+            data_[task_id] = stage_;
+        }
+};
+
+class Chain {
+    public:
+        int data[STAGE_WIDTH];
+        std::atomic<int> errors;
+        int stages_done;
+        int resumed_off_starter;
+        bool finished;
+        std::thread::id starter;
+
+        Chain() : errors(0), stages_done(0), resumed_off_starter(0), finished(false) {
+            for (int i = 0; i < STAGE_WIDTH; i++) {
+                data[i] = 0;
+            }
+        }
+};
+
+static DetachedCoroutine runChain(AwaitableTaskSystem sys, Chain* chain) {
+    for (int stage = 1; stage <= NUM_STAGES; stage++) {
+        StageTask task(chain -> data, stage, &chain -> errors);
+        co_await sys.launch(&task, STAGE_WIDTH);
+        chain -> stages_done++;
+        if (std::this_thread::get_id() != chain -> starter) {
+            chain -> resumed_off_starter++;
+        }
+    }
+    chain -> finished = true;
+}
+
+static bool testChains(ITaskSystem* t, ResumeThreads resume_threads) {
+    std::vector<Chain*> chains;
+    for (int c = 0; c < NUM_CHAINS; c++) {
+        chains.push_back(new Chain());
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    for (Chain* chain : chains) {
+        chain -> starter = std::this_thread::get_id();
+        runChain(AwaitableTaskSystem(t), chain);
+    }
+    t -> sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    bool passed = true;
+    int resumed_off_starter = 0;
+    for (Chain* chain : chains) {
+        passed = passed && chain -> finished && chain -> errors == 0 && chain -> stages_done == NUM_STAGES;
+        for (int i = 0; i < STAGE_WIDTH; i++) {
+            passed = passed && chain -> data[i] == NUM_STAGES;
+        }
+        if (resume_threads == RESUME_ON_WORKERS) {
+            passed = passed && chain -> resumed_off_starter == NUM_STAGES;
+        } else if (resume_threads == RESUME_ON_STARTER) {
+            passed = passed && chain -> resumed_off_starter == 0;
+        }
+        resumed_off_starter += chain -> resumed_off_starter;
+        delete chain;
+    }
+
+    printf("%-32s %d chains x %d stages: %8.3f ms, %d/%d resumed on pool threads%s: %s\n",
+           t -> name(), NUM_CHAINS, NUM_STAGES, (end_time - start_time) * 1000,
+           resumed_off_starter, NUM_CHAINS * NUM_STAGES,
+           resume_threads == RESUME_ANYWHERE ? " (not checked)" : "", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+class SlowTask: public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {
+            taskSleepFor(std::chrono::microseconds(1000));
+        }
+};
+
+class FailingTask: public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {
+            if (task_id == 0) {
+                throw std::runtime_error("stage failed");
+            }
+        }
+};
+
+class Outcome {
+    public:
+        TaskID awaited = -1;
+        bool finished = false;
+        bool caught = false;
+        int frames_freed = 0;
+};
+
+// Counts the coroutine frame as freed when it is destroyed.
+class FrameGuard {
+    public:
+        Outcome* outcome;
+        FrameGuard(Outcome* outcome) : outcome(outcome) {}
+        ~FrameGuard() {
+            outcome -> frames_freed++;
+        }
+};
+
+static DetachedCoroutine awaitCancelled(AwaitableTaskSystem sys, Outcome* outcome) {
+    FrameGuard guard(outcome);
+    SlowTask slow;
+    LaunchAwaitable launch = sys.launch(&slow, 64);
+    outcome -> awaited = launch.task_id;
+    co_await launch;
+    outcome -> finished = true;
+}
+
+static DetachedCoroutine awaitFailed(AwaitableTaskSystem sys, Outcome* outcome) {
+    FrameGuard guard(outcome);
+    FailingTask failing;
+    try {
+        co_await sys.launch(&failing, 16);
+        outcome -> finished = true;
+    } catch (const std::runtime_error&) {
+        outcome -> caught = true;
+    }
+}
+
+// With `asynchronous`, the cancel reaches the slow launch while the
+// coroutine waits for it; otherwise the launch is done before.
+static bool testCancelAndFailure(ITaskSystem* t, bool asynchronous) {
+    Outcome cancelled;
+    Outcome failed;
+    bool reported = false;
+
+    awaitCancelled(AwaitableTaskSystem(t), &cancelled);
+    t -> cancel(cancelled.awaited);
+    awaitFailed(AwaitableTaskSystem(t), &failed);
+    try {
+        t -> sync();
+    } catch (const std::exception&) {
+        reported = true;
+    }
+
+    bool passed = cancelled.frames_freed == 1 && cancelled.finished != asynchronous &&
+                  failed.frames_freed == 1 && failed.caught && !failed.finished && !reported;
+
+    printf("%-32s awaiting a %s launch and a failed one: %s\n",
+           t -> name(), asynchronous ? "cancelled" : "finished", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    bool passed = true;
+
+    TaskSystemParallelThreadPoolSleeping* sleeping = new TaskSystemParallelThreadPoolSleeping(NUM_THREADS);
+    passed = testChains(sleeping, RESUME_ANYWHERE) && passed;
+    passed = testCancelAndFailure(sleeping, true) && passed;
+    delete sleeping;
+
+    TaskSystemParallelThreadPoolStealing* stealing = new TaskSystemParallelThreadPoolStealing(NUM_THREADS);
+    passed = testChains(stealing, RESUME_ON_WORKERS) && passed;
+    passed = testCancelAndFailure(stealing, true) && passed;
+    delete stealing;
+
+    TaskSystemParallelThreadPoolFibers* fibers = new TaskSystemParallelThreadPoolFibers(NUM_THREADS);
+    passed = testChains(fibers, RESUME_ON_WORKERS) && passed;
+    passed = testCancelAndFailure(fibers, true) && passed;
+    delete fibers;
+
+    TaskSystemSerial* serial = new TaskSystemSerial(NUM_THREADS);
+    passed = testChains(serial, RESUME_ON_STARTER) && passed;
+    passed = testCancelAndFailure(serial, false) && passed;
+    delete serial;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <thread>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+
+/*
+ * Task graph capture on the sleeping pool.
+ *
+ * A diamond with a side branch is captured once and replayed many times.
+ * Every task takes a stamp from a shared clock when it starts and when it
+ * ends, and each replay checks that every launch started only after all
+ * tasks of each launch it depends on had ended.
+ *
+ * A second test keeps a capture open while pool threads run tasks that
+ * call run() themselves.  Those nested launches must run as usual rather
+ * than end up in the graph being captured.
+ */
+
+#define NUM_THREADS 8
+#define NUM_REPLAYS 200
+
+class StampTask: public IRunnable {
+    public:
+        std::atomic<int>* clock_;
+        std::atomic<int> first_start_;
+        std::atomic<int> last_end_;
+        std::atomic<int> tasks_run_;
+
+        StampTask(std::atomic<int>* clock) : clock_(clock) {
+            reset();
+        }
+
+        void reset() {
+            first_start_ = INT_MAX;
+            last_end_ = -1;
+            tasks_run_ = 0;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            int start = (*clock_)++;
+            int seen = first_start_;
+            while (start < seen && !first_start_.compare_exchange_weak(seen, start)) {}
+
+            volatile int spin = 0;
+            for (int i = 0; i < 2000; i++) {
+                spin += i;
+            }
+
+            int end = (*clock_)++;
+            seen = last_end_;
+            while (end > seen && !last_end_.compare_exchange_weak(seen, end)) {}
+            tasks_run_++;
+        }
+};
+
+class Edge {
+    public:
+        int from;
+        int to;
+};
+
+static bool testReplayOrder(TaskSystemParallelThreadPoolSleeping* t) {
+    std::atomic<int> clock(0);
+    const int num_launches = 5;
+    const int widths[num_launches] = {32, 16, 16, 8, 8};
+    // a -> b, a -> c, b -> d, c -> d, a -> e
+    const std::vector<Edge> edges = {{0, 1}, {0, 2}, {1, 3}, {2, 3}, {0, 4}};
+
+    std::vector<StampTask*> tasks;
+    for (int i = 0; i < num_launches; i++) {
+        tasks.push_back(new StampTask(&clock));
+    }
+
+    t -> beginCapture();
+    TaskID a = t -> runAsyncWithDeps(tasks[0], widths[0], {});
+    TaskID b = t -> runAsyncWithDeps(tasks[1], widths[1], {a});
+    TaskID c = t -> runAsyncWithDeps(tasks[2], widths[2], {a});
+    t -> runAsyncWithDeps(tasks[3], widths[3], {b, c});
+    t -> runAsyncWithDeps(tasks[4], widths[4], {a});
+    TaskGraph* graph = t -> endCapture();
+
+    // Nothing runs while capturing.
+    bool passed = graph -> num_nodes == num_launches;
+    for (int i = 0; i < num_launches; i++) {
+        passed = passed && tasks[i] -> tasks_run_ == 0;
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    int bad_edges = 0;
+    for (int replay = 0; replay < NUM_REPLAYS && passed; replay++) {
+        for (StampTask* task : tasks) {
+            task -> reset();
+        }
+        t -> launchGraph(graph);
+        t -> sync();
+        for (int i = 0; i < num_launches; i++) {
+            passed = passed && tasks[i] -> tasks_run_ == widths[i];
+        }
+        for (const Edge& edge : edges) {
+            if (tasks[edge.to] -> first_start_ <= tasks[edge.from] -> last_end_) {
+                bad_edges++;
+            }
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    passed = passed && bad_edges == 0;
+
+    printf("%-32s %d replays of %d launches: %8.3f ms, %d edges out of order: %s\n",
+           t -> name(), NUM_REPLAYS, num_launches, (end_time - start_time) * 1000, bad_edges,
+           passed ? "PASSED" : "FAILED");
+
+    delete graph;
+    for (StampTask* task : tasks) {
+        delete task;
+    }
+    return passed;
+}
+
+class CountTask: public IRunnable {
+    public:
+        std::atomic<int> tasks_run_;
+        CountTask() : tasks_run_(0) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            tasks_run_++;
+        }
+};
+
+class NestingTask: public IRunnable {
+    public:
+        ITaskSystem* system_;
+        CountTask* leaf_;
+        NestingTask(ITaskSystem* system, CountTask* leaf) : system_(system), leaf_(leaf) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            system_ -> run(leaf_, 10);
+        }
+};
+
+static bool testNestedLaunchesWhileCapturing(TaskSystemParallelThreadPoolSleeping* t) {
+    const int outer_tasks = 4;
+    CountTask leaf;
+    CountTask captured;
+    NestingTask outer(t, &leaf);
+
+    t -> runAsyncWithDeps(&outer, outer_tasks, {});
+    t -> beginCapture();
+    t -> runAsyncWithDeps(&captured, 16, {});
+    // Keep the capture open while the outer tasks make their launches.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TaskGraph* graph = t -> endCapture();
+    t -> sync();
+
+    bool passed = graph -> num_nodes == 1 && leaf.tasks_run_ == outer_tasks * 10 && captured.tasks_run_ == 0;
+    t -> launchGraph(graph);
+    t -> sync();
+    passed = passed && captured.tasks_run_ == 16;
+
+    printf("%-32s nested run() while capturing: %d/%d tasks ran, graph of %d nodes: %s\n",
+           t -> name(), int(leaf.tasks_run_), outer_tasks * 10, graph -> num_nodes,
+           passed ? "PASSED" : "FAILED");
+    delete graph;
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    bool passed = true;
+
+    TaskSystemParallelThreadPoolSleeping* sleeping = new TaskSystemParallelThreadPoolSleeping(NUM_THREADS);
+    passed = testReplayOrder(sleeping) && passed;
+    passed = testNestedLaunchesWhileCapturing(sleeping) && passed;
+    delete sleeping;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+
+/*
+ * Per-index dependencies on the sleeping pool.  A chain of four launches
+ * is linked one-to-one, then by a stencil, then by an index map.  Every
+ * task checks on entry that each task it depends on has already finished,
+ * and marks itself finished on exit.  Task lengths vary with the index,
+ * so tasks of consecutive launches overlap and finish out of order.
+ *
+ * Cancelling the second launch must also drop the tasks that depend on
+ * it, index by index, and sync() must still return.  So must a task of
+ * the second launch throwing, and wait() on the last launch must rethrow
+ * it, after which the pool must have no failure left on record.
+ *
+ * All of this runs again on pools that count the calling thread as a
+ * worker, including one with no pool threads at all, where only the
+ * thread calling sync() or wait() runs tasks.
+ */
+
+#define NUM_THREADS 8
+#define NUM_TASKS 256
+#define STENCIL_RADIUS 2
+#define NUM_ROUNDS 50
+
+static void spinFor(int iterations) {
+    volatile int spin = 0;
+    for (int i = 0; i < iterations; i++) {
+        spin += i;
+    }
+}
+
+/*
+ * ChainTask: one launch of the chain.  inputs_[i] lists the tasks of the
+ * previous launch that task i reads from.
+ */
+class ChainTask: public IRunnable {
+    public:
+        ChainTask* previous_;
+        std::atomic<bool>* gate_;
+        // Task that throws, or -1.
+        int throw_at_;
+        std::vector<std::vector<int> > inputs_;
+        std::atomic<int> finished_[NUM_TASKS];
+        std::atomic<int> tasks_run_;
+        std::atomic<int> errors_;
+
+        ChainTask(ChainTask* previous) : previous_(previous), gate_(nullptr), throw_at_(-1) {
+            inputs_.resize(NUM_TASKS);
+            reset();
+        }
+
+        void reset() {
+            for (int i = 0; i < NUM_TASKS; i++) {
+                finished_[i] = 0;
+            }
+            tasks_run_ = 0;
+            errors_ = 0;
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            while (gate_ != nullptr && !*gate_) {
+                std::this_thread::yield();
+            }
+            if (previous_ != nullptr) {
+                for (int j : inputs_[task_id]) {
+                    if (!previous_ -> finished_[j]) {
+                        errors_++;
+                    }
+                }
+            }
+            spinFor(((task_id * 37) % 11) * 500);
+            tasks_run_++;
+            if (task_id == throw_at_) {
+                throw std::runtime_error("chain task failed");
+            }
+            finished_[task_id] = 1;
+        }
+};
+
+class Chain {
+    public:
+        ChainTask first;
+        ChainTask one_to_one;
+        ChainTask stencil;
+        ChainTask mapped;
+        std::vector<int> index_map;
+        // The first launch's tasks wait for this to open.
+        std::atomic<bool> gate;
+
+        Chain() : first(nullptr), one_to_one(&first), stencil(&one_to_one), mapped(&stencil), gate(true) {
+            first.gate_ = &gate;
+            for (int i = 0; i < NUM_TASKS; i++) {
+                one_to_one.inputs_[i].push_back(i);
+                for (int j = i - STENCIL_RADIUS; j <= i + STENCIL_RADIUS; j++) {
+                    if (j >= 0 && j < NUM_TASKS) {
+                        stencil.inputs_[i].push_back(j);
+                    }
+                }
+                index_map.push_back((i * 7 + 3) % NUM_TASKS);
+                mapped.inputs_[i].push_back(index_map[i]);
+            }
+        }
+
+        void reset() {
+            first.reset();
+            one_to_one.reset();
+            stencil.reset();
+            mapped.reset();
+        }
+
+        // Submits the chain and returns the ids of its launches in order.
+        // With `whole_first`, the second launch waits for all of the first.
+        std::vector<TaskID> submit(TaskSystemParallelThreadPoolSleeping* t, bool whole_first = false) {
+            TaskID a = t -> runAsyncWithDeps(&first, NUM_TASKS, {});
+            TaskID b = whole_first ? t -> runAsyncWithDeps(&one_to_one, NUM_TASKS, {a})
+                                   : t -> runAsyncWithDeps(&one_to_one, NUM_TASKS, {},
+                                                           {IndexDependency(a, INDEX_ONE_TO_ONE)});
+            TaskID c = t -> runAsyncWithDeps(&stencil, NUM_TASKS, {},
+                                             {IndexDependency(b, INDEX_STENCIL, STENCIL_RADIUS)});
+            TaskID d = t -> runAsyncWithDeps(&mapped, NUM_TASKS, {}, {IndexDependency(c, index_map)});
+            return {a, b, c, d};
+        }
+
+        int errors() {
+            return one_to_one.errors_ + stencil.errors_ + mapped.errors_;
+        }
+
+        bool ranCompletely() {
+            return first.tasks_run_ == NUM_TASKS && one_to_one.tasks_run_ == NUM_TASKS &&
+                   stencil.tasks_run_ == NUM_TASKS && mapped.tasks_run_ == NUM_TASKS;
+        }
+};
+
+static bool testIndexOrder(TaskSystemParallelThreadPoolSleeping* t) {
+    Chain chain;
+    int errors = 0;
+    bool passed = true;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        chain.reset();
+        chain.submit(t);
+        t -> sync();
+        errors += chain.errors();
+        passed = passed && chain.ranCompletely();
+    }
+    double end_time = CycleTimer::currentSeconds();
+    passed = passed && errors == 0;
+
+    printf("%-32s one-to-one, stencil and map chains: %8.3f ms, %d tasks ran before an input: %s\n",
+           t -> name(), (end_time - start_time) * 1000, errors, passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+static bool testCancel(TaskSystemParallelThreadPoolSleeping* t, bool whole_first) {
+    Chain chain;
+    int errors = 0;
+    bool passed = true;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        chain.reset();
+        // Hold the first launch back so that nothing after it has run
+        // when the second one is cancelled.
+        chain.gate = false;
+        std::vector<TaskID> ids = chain.submit(t, whole_first);
+        t -> cancel(ids[1]);
+        chain.gate = true;
+        t -> sync();
+        errors += chain.errors();
+        passed = passed && chain.first.tasks_run_ == NUM_TASKS && chain.one_to_one.tasks_run_ == 0 &&
+                 chain.stencil.tasks_run_ == 0 && chain.mapped.tasks_run_ == 0;
+    }
+    passed = passed && errors == 0;
+
+    printf("%-32s cancel in the middle of a chain%s: %d tasks ran before an input: %s\n",
+           t -> name(), whole_first ? " (after a whole launch)" : "", errors, passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+static bool testException(TaskSystemParallelThreadPoolSleeping* t, bool whole_first) {
+    Chain chain;
+    chain.one_to_one.throw_at_ = NUM_TASKS / 2;
+    int errors = 0;
+    int rethrown = 0;
+    bool passed = true;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        chain.reset();
+        std::vector<TaskID> ids = chain.submit(t, whole_first);
+        try {
+            t -> wait(ids[3]);
+        } catch (const std::runtime_error&) {
+            rethrown++;
+        }
+        errors += chain.errors();
+        // The tasks near the one that threw depend on it.
+        passed = passed && chain.stencil.tasks_run_ < NUM_TASKS && chain.mapped.tasks_run_ < NUM_TASKS;
+    }
+    try {
+        t -> sync();
+    } catch (const std::exception&) {
+        passed = false;
+    }
+    passed = passed && errors == 0 && rethrown == NUM_ROUNDS && t -> errors.failed.empty() &&
+             t -> errors.unreported == nullptr;
+
+    printf("%-32s task throwing in the middle of a chain%s: %d/%d rethrown by wait(): %s\n",
+           t -> name(), whole_first ? " (after a whole launch)" : "", rethrown, NUM_ROUNDS,
+           passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    bool passed = true;
+
+    for (int num_threads : {NUM_THREADS, 2, 1}) {
+        bool caller_is_worker = num_threads != NUM_THREADS;
+        if (caller_is_worker) {
+            printf("Caller counted as a worker, num_threads %d:\n", num_threads);
+        }
+        TaskSystemParallelThreadPoolSleeping* sleeping =
+            new TaskSystemParallelThreadPoolSleeping(num_threads, caller_is_worker);
+        passed = testIndexOrder(sleeping) && passed;
+        passed = testCancel(sleeping, false) && passed;
+        passed = testCancel(sleeping, true) && passed;
+        passed = testException(sleeping, false) && passed;
+        passed = testException(sleeping, true) && passed;
+        delete sleeping;
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <new>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+
+/*
+ * Microbenchmark comparing the cost of the launch bookkeeping done per
+ * runAsyncWithDeps() and per completed launch: inserting a record,
+ * looking up a dependency by TaskID and retiring the record.
+ *
+ * The map layout is the node-based std::map<TaskID, Task*> part_b used
+ * before launch records moved into the LaunchTable.  Lookups are also
+ * timed from several threads at once, as workers resolve dependencies
+ * and wait() on launches concurrently.
+ */
+
+#define NUM_ROUNDS 20
+
+static double nsPerOp(double seconds, int ops) {
+    return seconds * 1e9 / ops;
+}
+
+// Task is over-aligned, which plain new does not honour before C++17.
+static Task* newTask(TaskID id) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, alignof(Task), sizeof(Task)) != 0) {
+        abort();
+    }
+    return new (memory) Task(id);
+}
+
+static void deleteTask(Task* task) {
+    task -> ~Task();
+    free(task);
+}
+
+// Random lookups into the live IDs, as dependency lists produce them.
+static std::vector<int> lookupOrder(int num_launches) {
+    std::vector<int> order(num_launches);
+    unsigned int seed = 12345;
+    for (int i = 0; i < num_launches; i++) {
+        seed = seed * 1103515245u + 12345u;
+        order[i] = int((seed >> 8) % unsigned(num_launches));
+    }
+    return order;
+}
+
+static void benchMap(int num_launches, const std::vector<int>& order) {
+    double insert_time = 0;
+    double lookup_time = 0;
+    double release_time = 0;
+    long checksum = 0;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        std::map<TaskID, Task*> task_id_to_task;
+        std::vector<TaskID> ids(num_launches);
+        TaskID next_id = TaskID(round) * num_launches;
+
+        double start = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            Task* task = newTask(next_id);
+            task -> reuse(nullptr, 1);
+            task_id_to_task[next_id] = task;
+            ids[i] = next_id++;
+        }
+        double inserted = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            auto it = task_id_to_task.find(ids[order[i]]);
+            checksum += it -> second -> num_total_tasks;
+        }
+        double looked_up = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            auto it = task_id_to_task.find(ids[i]);
+            deleteTask(it -> second);
+            task_id_to_task.erase(it);
+        }
+        double released = CycleTimer::currentSeconds();
+
+        insert_time += inserted - start;
+        lookup_time += looked_up - inserted;
+        release_time += released - looked_up;
+    }
+
+    int ops = num_launches * NUM_ROUNDS;
+    printf("  %-12s insert %7.1f ns  lookup %7.1f ns  release %7.1f ns  (%ld)\n", "std::map",
+           nsPerOp(insert_time, ops), nsPerOp(lookup_time, ops), nsPerOp(release_time, ops), checksum);
+}
+
+static void benchLaunchTable(int num_launches, const std::vector<int>& order) {
+    double insert_time = 0;
+    double lookup_time = 0;
+    double release_time = 0;
+    long checksum = 0;
+
+    // Reused across rounds, as in a long-running task system.
+    LaunchTable launches;
+    std::vector<Task*> tasks(num_launches);
+    std::vector<TaskID> ids(num_launches);
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        double start = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            tasks[i] = launches.allocate(nullptr, 1);
+            ids[i] = tasks[i] -> id;
+        }
+        double inserted = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            checksum += launches.find(ids[order[i]]) -> num_total_tasks;
+        }
+        double looked_up = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_launches; i++) {
+            launches.release(tasks[i]);
+        }
+        double released = CycleTimer::currentSeconds();
+
+        insert_time += inserted - start;
+        lookup_time += looked_up - inserted;
+        release_time += released - looked_up;
+    }
+
+    int ops = num_launches * NUM_ROUNDS;
+    printf("  %-12s insert %7.1f ns  lookup %7.1f ns  release %7.1f ns  (%ld)\n", "LaunchTable",
+           nsPerOp(insert_time, ops), nsPerOp(lookup_time, ops), nsPerOp(release_time, ops), checksum);
+}
+
+static void benchConcurrentLookups(int num_launches, const std::vector<int>& order, int num_threads) {
+    LaunchTable launches;
+    std::vector<TaskID> ids(num_launches);
+    for (int i = 0; i < num_launches; i++) {
+        ids[i] = launches.allocate(nullptr, 1) -> id;
+    }
+
+    std::vector<long> checksums(num_threads, 0);
+    std::vector<std::thread> threads;
+    double start = CycleTimer::currentSeconds();
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            long sum = 0;
+            for (int round = 0; round < NUM_ROUNDS; round++) {
+                for (int i = 0; i < num_launches; i++) {
+                    sum += launches.find(ids[order[(i + t) % num_launches]]) -> num_total_tasks;
+                }
+            }
+            checksums[t] = sum;
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = CycleTimer::currentSeconds() - start;
+
+    long checksum = 0;
+    for (long c : checksums) {
+        checksum += c;
+    }
+    printf("  %-12s lookup %7.1f ns per thread with %d threads  (%ld)\n", "LaunchTable",
+           nsPerOp(elapsed, num_launches * NUM_ROUNDS), num_threads, checksum);
+}
+
+int main(int argc, char** argv) {
+    int sizes[] = {1 << 10, 1 << 14, 1 << 18};
+
+    for (int num_launches : sizes) {
+        std::vector<int> order = lookupOrder(num_launches);
+        printf("%d launches in flight:\n", num_launches);
+        benchMap(num_launches, order);
+        benchLaunchTable(num_launches, order);
+        benchConcurrentLookups(num_launches, order, std::max(4, int(std::thread::hardware_concurrency())));
+    }
+    return 0;
+}
@@ -28,6 +28,8 @@ enum TaskSystemType {
     PARALLEL_SPAWN,
     PARALLEL_THREAD_POOL_SPINNING,
     PARALLEL_THREAD_POOL_SLEEPING,
+    PARALLEL_THREAD_POOL_STEALING,
+    PARALLEL_THREAD_POOL_FIBERS,
     N_TASKSYS_IMPLS, // This must be in the last position.
 };
 
@@ -42,6 +44,10 @@ ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
         return new TaskSystemParallelThreadPoolSpinning(num_threads);
     } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
         return new TaskSystemParallelThreadPoolSleeping(num_threads);
+    } else if (type == PARALLEL_THREAD_POOL_STEALING) {
+        return new TaskSystemParallelThreadPoolStealing(num_threads);
+    } else if (type == PARALLEL_THREAD_POOL_FIBERS) {
+        return new TaskSystemParallelThreadPoolFibers(num_threads);
     } else {
         return NULL;
     }
@@ -49,7 +55,7 @@ ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
 
 int main(int argc, char** argv)
 {
-    const int n_tests = 31;
+    const int n_tests = 37;
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
 
@@ -83,6 +89,14 @@ int main(int argc, char** argv)
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        waitSubsetDepsTest,
+        nestedFibonacciTest,
+        nestedFibonacciAsyncTest,
+        launchFutureTest,
+        cancelLaunchTest,
+        taskExceptionTest,
+        concurrentWaitTest,
+        blockingSleepTest,
     };
 
     std::string test_names[n_tests] = {
@@ -115,6 +129,14 @@ int main(int argc, char** argv)
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "wait_subset_deps_async",
+        "nested_fibonacci",
+        "nested_fibonacci_async",
+        "launch_future_async",
+        "cancel_launch_async",
+        "task_exception_async",
+        "concurrent_wait_async",
+        "blocking_sleep",
     };
  
     // Parse commandline options
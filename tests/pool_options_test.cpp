@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+#include "CycleTimer.h"
+#include "tasksys.h"
+#include "tests.h"
+
+/*
+ * The part_a thread pools under the options runtasks does not exercise.
+ *
+ * A set of the sync tests runs on the spinning and the sleeping pool with
+ * each Partitioner set through setPartitioner(), both with the default
+ * grain size and with a small one.  A last test switches partitioners
+ * from one launch to the next through the three-argument run() and checks
+ * that every launch runs each of its tasks exactly once.
+ *
+ * The same sync tests run on sleeping pools that wait with WAIT_HYBRID,
+ * with a short and with the default spin budget.
+ *
+ * Last, both pools count the calling thread as a worker, with
+ * num_threads of 1, where the caller runs every task without a single
+ * pool thread, and of NUM_THREADS, and run the sync tests and the
+ * changing partitioners.
+ */
+
+#define NUM_THREADS 4
+#define NUM_MIXED_LAUNCHES 200
+
+struct SyncTest {
+    const char* name;
+    TestResults (*run)(ITaskSystem* t);
+};
+
+static const SyncTest sync_tests[] = {
+    {"simple_test_sync", simpleTestSync},
+    {"super_super_light", superSuperLightTest},
+    {"nested_fibonacci", nestedFibonacciTest},
+    {"math_operations_in_tight_for_loop_reduction_tree", mathOperationsInTightForLoopReductionTreeTest},
+};
+
+static const char* partitioner_names[] = {"static", "dynamic", "guided", "auto", "affinity"};
+
+static bool runSyncTests(ITaskSystem* t, const char* options) {
+    bool passed = true;
+    for (const SyncTest& test : sync_tests) {
+        TestResults result = test.run(t);
+        printf("%-32s %-24s %-50s %8.3f ms: %s\n", t -> name(), options, test.name,
+               result.time * 1000, result.passed ? "PASSED" : "FAILED");
+        passed = passed && result.passed;
+    }
+    return passed;
+}
+
+template <class TaskSystem>
+static bool testPartitioners() {
+    bool passed = true;
+    for (int kind = PARTITION_STATIC; kind <= PARTITION_AFFINITY; kind++) {
+        for (int grain_size : {0, 3}) {
+            char options[64];
+            snprintf(options, sizeof(options), "%s, grain %d", partitioner_names[kind], grain_size);
+            TaskSystem* t = new TaskSystem(NUM_THREADS);
+            t -> setPartitioner(Partitioner(PartitionerKind(kind), grain_size));
+            passed = runSyncTests(t, options) && passed;
+            delete t;
+        }
+    }
+    return passed;
+}
+
+static bool testHybridWait() {
+    bool passed = true;
+    for (int spin_budget : {64, DEFAULT_SPIN_BUDGET}) {
+        char options[64];
+        snprintf(options, sizeof(options), "hybrid, spin budget %d", spin_budget);
+        TaskSystemParallelThreadPoolSleeping* t =
+            new TaskSystemParallelThreadPoolSleeping(NUM_THREADS, false, WAIT_HYBRID, spin_budget);
+        if (t -> spinBudget() != spin_budget) {
+            printf("%-32s %-24s spin budget %d: FAILED\n", t -> name(), options, t -> spinBudget());
+            passed = false;
+        }
+        passed = runSyncTests(t, options) && passed;
+        delete t;
+    }
+    return passed;
+}
+
+class CountEachTask: public IRunnable {
+    public:
+        std::vector<std::atomic<int>> runs_;
+
+        CountEachTask(int num_total_tasks) : runs_(num_total_tasks) {
+            reset();
+        }
+
+        void reset() {
+            for (std::atomic<int>& runs : runs_) {
+                runs = 0;
+            }
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            runs_[task_id]++;
+        }
+
+        bool ranEachOnce(int num_total_tasks) {
+            for (int i = 0; i < int(runs_.size()); i++) {
+                if (runs_[i] != (i < num_total_tasks ? 1 : 0)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+template <class TaskSystem>
+static bool testMixedPartitioners(TaskSystem* t) {
+    const int max_tasks = 512;
+    CountEachTask task(max_tasks);
+    bool passed = true;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < NUM_MIXED_LAUNCHES; i++) {
+        // Vary the shape too, so affinity launches both repeat and change
+        // the shape of the previous one.
+        int num_tasks = (i / 10) % 2 == 0 ? max_tasks : 1 + (i * 37) % max_tasks;
+        task.reset();
+        t -> run(&task, num_tasks, Partitioner(PartitionerKind(i % 5), i % 3 * 4));
+        passed = passed && task.ranEachOnce(num_tasks);
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    printf("%-32s partitioner changing every launch: %8.3f ms: %s\n",
+           t -> name(), (end_time - start_time) * 1000, passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+template <class TaskSystem>
+static bool testCallerAsWorker() {
+    bool passed = true;
+    for (int num_threads : {1, NUM_THREADS}) {
+        char options[64];
+        snprintf(options, sizeof(options), "caller counted, n=%d", num_threads);
+        TaskSystem* t = new TaskSystem(num_threads, true);
+        passed = runSyncTests(t, options) && passed;
+        passed = testMixedPartitioners(t) && passed;
+        delete t;
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    bool passed = true;
+
+    passed = testPartitioners<TaskSystemParallelThreadPoolSpinning>() && passed;
+    passed = testPartitioners<TaskSystemParallelThreadPoolSleeping>() && passed;
+
+    TaskSystemParallelThreadPoolSpinning* spinning = new TaskSystemParallelThreadPoolSpinning(NUM_THREADS);
+    passed = testMixedPartitioners(spinning) && passed;
+    delete spinning;
+    TaskSystemParallelThreadPoolSleeping* sleeping = new TaskSystemParallelThreadPoolSleeping(NUM_THREADS);
+    passed = testMixedPartitioners(sleeping) && passed;
+    delete sleeping;
+
+    passed = testHybridWait() && passed;
+    passed = testCallerAsWorker<TaskSystemParallelThreadPoolSpinning>() && passed;
+    passed = testCallerAsWorker<TaskSystemParallelThreadPoolSleeping>() && passed;
+
+    return passed ? 0 : 1;
+}
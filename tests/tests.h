@@ -6,9 +6,11 @@
 #include <thread>
 #include <atomic>
 #include <set>
+#include <stdexcept>
 
 #include "CycleTimer.h"
 #include "itasksys.h"
+#include "LaunchFuture.h"
 
 /*
 Sync tests
@@ -18,11 +20,13 @@ TestResults pingPongUnequalTest(ITaskSystem *t);
 TestResults superLightTest(ITaskSystem *t);
 TestResults superSuperLightTest(ITaskSystem *t);
 TestResults recursiveFibonacciTest(ITaskSystem* t);
+TestResults nestedFibonacciTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsTest(ITaskSystem *t);
 TestResults mandelbrotChunkedTest(ITaskSystem* t);
+TestResults blockingSleepTest(ITaskSystem* t);
 
 Async with dependencies tests
 =============================
@@ -31,12 +35,17 @@ TestResults pingPongUnequalAsyncTest(ITaskSystem *t);
 TestResults superLightAsyncTest(ITaskSystem *t);
 TestResults superSuperLightAsyncTest(ITaskSystem *t);
 TestResults recursiveFibonacciAsyncTest(ITaskSystem* t);
+TestResults nestedFibonacciAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopFanInAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
+TestResults launchFutureTest(ITaskSystem* t);
+TestResults cancelLaunchTest(ITaskSystem* t);
+TestResults taskExceptionTest(ITaskSystem* t);
+TestResults concurrentWaitTest(ITaskSystem* t);
 */
 
 /*
@@ -227,6 +236,49 @@ class RecursiveFibonacciTask: public IRunnable {
         }
 };
 
+/*
+ * Each task computes a fibonacci number like RecursiveFibonacciTask, but
+ * above cutoff_ it computes the two subproblems as a nested bulk launch
+ * of two tasks on the same task system, made from inside runTask.  When
+ * split_ is set, task i computes the (idx_ - i)-th number instead of the
+ * idx_-th.
+ */
+class NestedFibonacciTask: public IRunnable {
+    public:
+        ITaskSystem* t_;
+        int idx_;
+        int cutoff_;
+        bool do_async_;
+        bool split_;
+        int *output_;
+        NestedFibonacciTask(ITaskSystem* t, int idx, int cutoff, bool do_async, bool split, int *output)
+            : t_(t), idx_(idx), cutoff_(cutoff), do_async_(do_async), split_(split), output_(output) {}
+        ~NestedFibonacciTask() {}
+
+        int slowFn(int n) {
+            if (n < 2) return 1;
+            return slowFn(n-1) + slowFn(n-2);
+        }
+
+        int nestedFn(int n) {
+            if (n <= cutoff_) return slowFn(n);
+            int halves[2] = {0, 0};
+            NestedFibonacciTask children(t_, n - 1, cutoff_, do_async_, true, halves);
+            if (do_async_) {
+                std::vector<TaskID> deps;
+                t_->runAsyncWithDeps(&children, 2, deps);
+                t_->sync();
+            } else {
+                t_->run(&children, 2);
+            }
+            return halves[0] + halves[1];
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            output_[task_id] = nestedFn(split_ ? idx_ - task_id : idx_);
+        }
+};
+
 /*
  * Each task copies its task id into the output.
  */
@@ -768,6 +820,53 @@ TestResults recursiveFibonacciTestBase(ITaskSystem* t, bool do_async) {
     return result;
 }
 
+TestResults nestedFibonacciTestBase(ITaskSystem* t, bool do_async) {
+
+    int num_tasks = 16;
+    int fib_index = 24;
+    int cutoff = 19;
+
+    int* task_output = new int[num_tasks];
+    for (int i = 0; i < num_tasks; i++) {
+        task_output[i] = 0;
+    }
+
+    NestedFibonacciTask fib_task(t, fib_index, cutoff, do_async, false, task_output);
+
+    double start_time = CycleTimer::currentSeconds();
+    if (do_async) {
+        std::vector<TaskID> deps; // Call runAsyncWithDeps without dependencies
+        t->runAsyncWithDeps(&fib_task, num_tasks, deps);
+        t->sync();
+    } else {
+        t->run(&fib_task, num_tasks);
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    // Validate correctness
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_tasks; i++) {
+        if (task_output[i] != 75025) {
+            printf("%d\n", task_output[i]);
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] task_output;
+    return result;
+}
+
+TestResults nestedFibonacciTest(ITaskSystem* t) {
+    return nestedFibonacciTestBase(t, false);
+}
+
+TestResults nestedFibonacciAsyncTest(ITaskSystem* t) {
+    return nestedFibonacciTestBase(t, true);
+}
+
 TestResults recursiveFibonacciTest(ITaskSystem* t) {
     return recursiveFibonacciTestBase(t, false);
 }
@@ -1403,3 +1502,401 @@ TestResults strictGraphDepsMedium(ITaskSystem* t) {
 TestResults strictGraphDepsLarge(ITaskSystem* t) {
     return strictGraphDepsTestBase(t,1000,20000,0);
 }
+
+/*
+ * Computation: two independent chains of strict dependency tasks.  Waiting
+ * on the last launch of one chain checks that wait() returns only once that
+ * chain is complete and that isDone() then reports it as done, without
+ * calling sync() first.
+ */
+TestResults waitSubsetDepsTest(ITaskSystem* t) {
+    const int num_chains = 2;
+    const int chain_length = 8;
+    const int num_launches = num_chains * chain_length;
+
+    bool *done = new bool[num_launches]();
+    std::vector<std::vector<bool*>> dep_flags(num_launches);
+    std::vector<IRunnable*> tasks(num_launches);
+    std::vector<TaskID> task_ids(num_launches);
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_launches; i++) {
+        std::vector<TaskID> deps;
+        if (i % chain_length != 0) {
+            dep_flags[i].push_back(done + i - 1);
+            deps.push_back(task_ids[i - 1]);
+        }
+        tasks[i] = new StrictDependencyTask(dep_flags[i], done + i);
+        task_ids[i] = t->runAsyncWithDeps(tasks[i], 16, deps);
+    }
+
+    bool passed = true;
+    for (int c = 0; c < num_chains; c++) {
+        int last = (c + 1) * chain_length - 1;
+        if (c == 0) {
+            t->wait(task_ids[last]);
+        } else {
+            t->wait(std::vector<TaskID>(task_ids.begin() + c * chain_length,
+                                        task_ids.begin() + last + 1));
+        }
+        passed = passed && done[last] && t->isDone(task_ids[last]);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = passed;
+    result.time = end_time - start_time;
+
+    for (int i = 0; i < num_launches; i++) {
+        delete tasks[i];
+    }
+    delete[] done;
+
+    return result;
+}
+
+/*
+ * ThrowingTask: throws from every task whose index is a multiple of
+ * throw_every.
+ */
+class ThrowingTask : public IRunnable {
+    public:
+        int throw_every_;
+        std::atomic<int> tasks_run_;
+
+        ThrowingTask(int throw_every) : throw_every_(throw_every), tasks_run_(0) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            tasks_run_++;
+            if (task_id % throw_every_ == 0) {
+                throw std::runtime_error("task failed");
+            }
+        }
+};
+
+/*
+ * Computation: diamonds of launches built with LaunchFuture after their
+ * first launch has been submitted.  Each stage writes one more than the
+ * sum of its inputs; a whenAll() join combines two branches and a
+ * whenAny() continuation checks that at least one branch had finished
+ * before it started.  Then a whenAll() over a failing input, once while
+ * the input runs and once after it has finished, must fail as well and
+ * skip its continuation.
+ */
+class FutureStageTask : public IRunnable {
+    public:
+        const int* in_a_;
+        const int* in_b_;
+        int* out_;
+        std::atomic<int> tasks_ended_;
+
+        FutureStageTask(const int* in_a, const int* in_b, int* out)
+            : in_a_(in_a), in_b_(in_b), out_(out), tasks_ended_(0) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            out_[task_id] = in_a_[task_id] + (in_b_ ? in_b_[task_id] : 0) + 1;
+            tasks_ended_++;
+        }
+
+        bool finished(int num_total_tasks) {
+            return tasks_ended_ == num_total_tasks;
+        }
+};
+
+class AnyOfCheckTask : public IRunnable {
+    public:
+        FutureStageTask* first_;
+        FutureStageTask* second_;
+        int width_;
+        bool satisfied_;
+
+        AnyOfCheckTask(FutureStageTask* first, FutureStageTask* second, int width)
+            : first_(first), second_(second), width_(width), satisfied_(false) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            satisfied_ = first_->finished(width_) || second_->finished(width_);
+        }
+};
+
+TestResults launchFutureTest(ITaskSystem* t) {
+    const int num_rounds = 64;
+    const int width = 32;
+
+    std::vector<int*> buffers;
+    std::vector<IRunnable*> tasks;
+    std::vector<AnyOfCheckTask*> checks;
+    std::vector<int*> results;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int r = 0; r < num_rounds; r++) {
+        int* zero = new int[width]();
+        int* a = new int[width]();
+        int* b = new int[width]();
+        int* c = new int[width]();
+        int* d = new int[width]();
+        FutureStageTask* stage_a = new FutureStageTask(zero, nullptr, a);
+        FutureStageTask* stage_b = new FutureStageTask(a, nullptr, b);
+        FutureStageTask* stage_c = new FutureStageTask(a, nullptr, c);
+        FutureStageTask* stage_d = new FutureStageTask(b, c, d);
+        AnyOfCheckTask* check = new AnyOfCheckTask(stage_b, stage_c, width);
+
+        LaunchFuture fa = launchFuture(t, stage_a, width);
+        LaunchFuture fb = fa.then(stage_b, width);
+        LaunchFuture fc = fa.then(stage_c, width);
+        whenAll({fb, fc}).then(stage_d, width);
+        whenAny({fb, fc}).then(check, 1);
+
+        for (int* buffer : {zero, a, b, c, d}) {
+            buffers.push_back(buffer);
+        }
+        for (IRunnable* task : std::vector<IRunnable*>{stage_a, stage_b, stage_c, stage_d, check}) {
+            tasks.push_back(task);
+        }
+        checks.push_back(check);
+        results.push_back(d);
+    }
+    t->sync();
+
+    // Task systems that run launches on submission throw from there.
+    int* unused = new int[width]();
+    buffers.push_back(unused);
+    ThrowingTask thrower(width);
+    ThrowingTask finished_thrower(width);
+    FutureStageTask sibling(unused, nullptr, unused);
+    FutureStageTask skipped(unused, nullptr, unused);
+    bool running_threw = false;
+    try {
+        LaunchFuture failing = launchFuture(t, &thrower, width);
+        whenAll({failing, launchFuture(t, &sibling, width)}).then(&skipped, width).wait();
+    } catch (const std::runtime_error&) {
+        running_threw = true;
+    }
+    bool finished_threw = false;
+    try {
+        LaunchFuture failing = launchFuture(t, &finished_thrower, width);
+        while (!failing.isDone()) {
+            std::this_thread::yield();
+        }
+        whenAll({failing}).then(&skipped, width).wait();
+    } catch (const std::runtime_error&) {
+        finished_threw = true;
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = running_threw && finished_threw && skipped.tasks_ended_ == 0;
+    for (int r = 0; r < num_rounds; r++) {
+        result.passed = result.passed && checks[r]->satisfied_;
+        for (int i = 0; i < width; i++) {
+            result.passed = result.passed && results[r][i] == 5;
+        }
+    }
+    result.time = end_time - start_time;
+
+    for (int* buffer : buffers) {
+        delete[] buffer;
+    }
+    for (IRunnable* task : tasks) {
+        delete task;
+    }
+    return result;
+}
+
+/*
+ * Computation: a wide speculative launch followed by a chain of two
+ * dependent launches, with the first cancelled right after submission.
+ * With task systems that run launches synchronously the cancel comes too
+ * late to skip anything, but a dependent launch is cancelled before it
+ * starts or not at all, so it runs either completely or not at all, and
+ * the last one only if the one before it ran completely.  Otherwise the
+ * cancel arrives while the slow search has barely started: part of it
+ * must be skipped, and all of both dependent launches.
+ */
+class SpeculativeTask : public IRunnable {
+    public:
+        int sleep_us_;
+        std::atomic<int> tasks_run_;
+
+        SpeculativeTask(int sleep_us) : sleep_us_(sleep_us), tasks_run_(0) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (isCancelled()) {
+                return;
+            }
+            if (sleep_us_ > 0) {
+                taskSleepFor(std::chrono::microseconds(sleep_us_));
+            }
+            tasks_run_++;
+        }
+};
+
+TestResults cancelLaunchTest(ITaskSystem* t) {
+    const int search_tasks = 1024;
+    const int stage_tasks = 64;
+
+    SpeculativeTask search(100);
+    SpeculativeTask stage(0);
+    SpeculativeTask last(0);
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID search_id = t->runAsyncWithDeps(&search, search_tasks, std::vector<TaskID>());
+    TaskID stage_id = t->runAsyncWithDeps(&stage, stage_tasks, std::vector<TaskID>{search_id});
+    TaskID last_id = t->runAsyncWithDeps(&last, stage_tasks, std::vector<TaskID>{stage_id});
+    bool asynchronous = !t->isDone(search_id);
+    t->cancel(search_id);
+    t->wait(last_id);
+    bool done = t->isDone(search_id) && t->isDone(stage_id) && t->isDone(last_id);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    int stage_run = stage.tasks_run_;
+    int last_run = last.tasks_run_;
+    TestResults result;
+    if (asynchronous) {
+        result.passed = done && search.tasks_run_ < search_tasks && stage_run == 0 && last_run == 0;
+    } else {
+        result.passed = done && search.tasks_run_ <= search_tasks &&
+                        (stage_run == 0 || stage_run == stage_tasks) &&
+                        (last_run == 0 || last_run == stage_tasks) &&
+                        (last_run == 0 || stage_run == stage_tasks);
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: launches whose tasks throw.  run() must rethrow, and so
+ * must wait() on a launch that depends on a failed one, which is skipped.
+ * The task system has to stay usable afterwards: a new launch runs
+ * completely and sync() has nothing left to report.
+ */
+TestResults taskExceptionTest(ITaskSystem* t) {
+    const int num_tasks = 1024;
+    const int dependent_tasks = 64;
+
+    ThrowingTask run_thrower(97);
+    ThrowingTask async_thrower(num_tasks);
+    SpeculativeTask dependent(0);
+    SpeculativeTask after(0);
+
+    double start_time = CycleTimer::currentSeconds();
+    bool run_threw = false;
+    try {
+        t->run(&run_thrower, num_tasks);
+    } catch (const std::runtime_error&) {
+        run_threw = true;
+    }
+
+    bool wait_threw = false;
+    try {
+        TaskID failing_id = t->runAsyncWithDeps(&async_thrower, num_tasks, std::vector<TaskID>());
+        TaskID dependent_id = t->runAsyncWithDeps(&dependent, dependent_tasks, std::vector<TaskID>{failing_id});
+        t->wait(dependent_id);
+    } catch (const std::runtime_error&) {
+        wait_threw = true;
+    }
+
+    bool sync_threw = false;
+    try {
+        t->run(&after, dependent_tasks);
+        t->sync();
+    } catch (...) {
+        sync_threw = true;
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = run_threw && wait_threw && !sync_threw &&
+                    dependent.tasks_run_ == 0 && after.tasks_run_ == dependent_tasks;
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: several threads outside the task system each submit
+ * launches and wait() for them, all at the same time.  Every waiting
+ * thread must be woken when its own launch finishes.
+ */
+class CountingTask : public IRunnable {
+    public:
+        std::atomic<int> tasks_run_;
+
+        CountingTask() : tasks_run_(0) {}
+
+        // Sleeps briefly so the waiters block while pool threads run it.
+        void runTask(int task_id, int num_total_tasks) {
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+            tasks_run_++;
+        }
+};
+
+TestResults concurrentWaitTest(ITaskSystem* t) {
+    const int num_waiters = 4;
+    const int num_rounds = 1000;
+    const int num_tasks = 8;
+
+    CountingTask counters[num_waiters];
+    std::thread waiters[num_waiters];
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int w = 0; w < num_waiters; w++) {
+        waiters[w] = std::thread([t, &counters, w]() {
+            for (int r = 0; r < num_rounds; r++) {
+                TaskID id = t->runAsyncWithDeps(&counters[w], num_tasks, std::vector<TaskID>());
+                t->wait(id);
+            }
+        });
+    }
+    for (int w = 0; w < num_waiters; w++) {
+        waiters[w].join();
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int w = 0; w < num_waiters; w++) {
+        result.passed = result.passed && counters[w].tasks_run_ == num_rounds * num_tasks;
+    }
+    result.time = end_time - start_time;
+    return result;
+}
+
+/*
+ * Computation: launches whose tasks spend most of their time asleep in
+ * taskSleepFor().  Task systems with spare threads, or with fibers, run
+ * other tasks while those sleep, so the launches take far less than
+ * num_tasks sleeps divided by the number of threads.
+ */
+class BlockingSleepTask : public IRunnable {
+    public:
+        int sleep_us_;
+        std::atomic<int> tasks_run_;
+
+        BlockingSleepTask(int sleep_us) : sleep_us_(sleep_us), tasks_run_(0) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            taskSleepFor(std::chrono::microseconds(sleep_us_));
+            tasks_run_++;
+        }
+};
+
+TestResults blockingSleepTest(ITaskSystem* t) {
+    const int num_launches = 8;
+    const int num_tasks = 64;
+    const int sleep_us = 500;
+
+    BlockingSleepTask task(sleep_us);
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_launches; i++) {
+        t->run(&task, num_tasks);
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = task.tasks_run_ == num_launches * num_tasks;
+    result.time = end_time - start_time;
+    return result;
+}